@@ -0,0 +1,3498 @@
+/*  __    ___         __    ___   ___   __
+ * / /`  / / \  ___  / /`_ | |_) | |_) / /`
+ * \_\_, \_\_/ |___| \_\_/ |_| \ |_|   \_\_,
+ *
+ * MIT License
+ *
+ * Copyright (c) 2021 Donald-Rupin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ *  @file client.hpp
+ *
+ */
+
+#ifndef CO_GRPC_CLIENT_HPP_
+#define CO_GRPC_CLIENT_HPP_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "co_grpc.hpp"
+
+namespace grpc {
+    class Alarm;
+    class Channel;
+    class ChannelArguments;
+    class ChannelCredentials;
+    class ClientContext;
+    class CompletionQueue;
+    class PropagationOptions;
+    class Status;
+
+    template <class R>
+    class ClientAsyncReader;
+
+    template <class R>
+    class ClientAsyncResponseReader;
+}   // namespace grpc
+
+namespace co_grpc {
+
+    /*
+     * The result of a unary call.
+     *
+     */
+    template <typename Response>
+    struct reply {
+
+            grpc::Status status;
+
+            Response message;
+
+            explicit operator bool() const noexcept { return status.ok(); }
+    };
+
+    /*
+     * When a `circuit_breaker` opens and for how long.
+     *
+     */
+    struct breaker_options {
+
+            /* The share of calls in a window that must fail to open the circuit */
+            double failure_ratio = 0.5;
+
+            /* Calls a window needs before it can open the circuit */
+            std::size_t min_calls = 20;
+
+            std::chrono::microseconds window{10000000};
+
+            /* How long an open circuit rejects calls before letting a probe through */
+            std::chrono::microseconds open_for{5000000};
+
+            /* Calls that take longer count as failures */
+            std::chrono::microseconds slow_call{1000000};
+
+            /* Bit `1 << code` is set for each `grpc::StatusCode` that counts as a failure */
+            std::uint32_t failures = 1u << grpc::StatusCode::UNKNOWN |
+                                     1u << grpc::StatusCode::DEADLINE_EXCEEDED |
+                                     1u << grpc::StatusCode::RESOURCE_EXHAUSTED |
+                                     1u << grpc::StatusCode::INTERNAL |
+                                     1u << grpc::StatusCode::UNAVAILABLE;
+    };
+
+    /*
+     * A lock free circuit breaker.
+     *
+     * While closed, calls are counted in fixed windows and the circuit opens once enough of a
+     * window has failed. An open circuit rejects calls until `open_for` has passed, then lets a
+     * single probe through (half open). The probe closes the circuit if it succeeds and opens it
+     * again if it fails. A cancelled probe reopens it without waiting, so the next call probes.
+     * Calls that were already running when it went half open do not decide it.
+     *
+     * The state and the counts of the window are packed into one word. Outcomes are recorded by
+     * the thread draining the completion queue while callers only move an open circuit to half
+     * open, so every change is a single compare and swap.
+     *
+     */
+    class circuit_breaker {
+
+        public:
+
+            enum State : std::uint64_t {
+                kClosed,
+                kOpen,
+                kHalfOpen
+            };
+
+            circuit_breaker() noexcept : state_(kClosed), window_(0), opened_(0) { }
+
+            /* Not thread safe, set before calls are made */
+            void
+            configure(const breaker_options& _options) noexcept
+            {
+                options_ = _options;
+                window_.store(now(), std::memory_order_relaxed);
+            }
+
+            State
+            state() const noexcept
+            {
+                return static_cast<State>(state_.load(std::memory_order_relaxed) & kStateMask);
+            }
+
+            /*
+             * Whether a call may be made, moving an open circuit to half open when it is due.
+             * `_probe` is set for the call that moved it, which must be recorded as the probe.
+             *
+             */
+            bool
+            allow(bool& _probe) noexcept
+            {
+                auto state = state_.load(std::memory_order_acquire);
+                switch (state & kStateMask)
+                {
+                    case kClosed:
+                        return true;
+
+                    case kHalfOpen:
+                        return false;
+
+                    default:
+                        if (now() - opened_.load(std::memory_order_relaxed) <
+                            options_.open_for.count())
+                        {
+                            return false;
+                        }
+
+                        /* Only the caller that moves it gets to probe */
+                        _probe = state_.compare_exchange_strong(
+                            state,
+                            kHalfOpen,
+                            std::memory_order_acq_rel,
+                            std::memory_order_relaxed);
+                        return _probe;
+                }
+            }
+
+            void
+            record(
+                bool                                _ok,
+                int                                 _code,
+                std::chrono::steady_clock::duration _latency,
+                bool                                _probe = false) noexcept
+            {
+                const auto time = now();
+
+                /* Cancelled by the caller, which says nothing about the server */
+                const bool neutral = _ok && _code == grpc::StatusCode::CANCELLED;
+                const bool failed  = !_ok || (options_.failures >> _code & 1) ||
+                                    _latency >= options_.slow_call;
+
+                auto state = state_.load(std::memory_order_relaxed);
+                while (true)
+                {
+                    std::uint64_t next;
+                    switch (state & kStateMask)
+                    {
+                        case kOpen:
+                            /* Calls made before it opened */
+                            return;
+
+                        case kHalfOpen:
+                            /* Calls made before it went half open */
+                            if (!_probe) { return; }
+
+                            if (neutral) { next = kOpen; }
+                            else if (failed)
+                            {
+                                opened_.store(time, std::memory_order_relaxed);
+                                next = kOpen;
+                            }
+                            else
+                            {
+                                window_.store(time, std::memory_order_relaxed);
+                                next = kClosed;
+                            }
+                            break;
+
+                        default:
+                        {
+                            if (neutral) { return; }
+
+                            std::uint64_t calls    = state >> kCallsShift & kCountMask;
+                            std::uint64_t failures = state >> kFailuresShift;
+
+                            if (time - window_.load(std::memory_order_relaxed) >=
+                                options_.window.count())
+                            {
+                                window_.store(time, std::memory_order_relaxed);
+                                calls    = 0;
+                                failures = 0;
+                            }
+
+                            if (calls < kCountMask)
+                            {
+                                ++calls;
+                                failures += failed;
+                            }
+
+                            if (calls >= options_.min_calls &&
+                                failures >= options_.failure_ratio * calls)
+                            {
+                                opened_.store(time, std::memory_order_relaxed);
+                                next = kOpen;
+                            }
+                            else
+                            {
+                                next = kClosed | calls << kCallsShift | failures << kFailuresShift;
+                            }
+                        }
+                    }
+
+                    if (state_.compare_exchange_weak(
+                            state,
+                            next,
+                            std::memory_order_release,
+                            std::memory_order_relaxed))
+                    {
+                        return;
+                    }
+                }
+            }
+
+        private:
+
+            static inline std::int64_t
+            now() noexcept
+            {
+                return std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch())
+                    .count();
+            }
+
+            static constexpr std::uint64_t kStateMask     = 0b11;
+            static constexpr unsigned      kCallsShift    = 2;
+            static constexpr unsigned      kFailuresShift = 33;
+            static constexpr std::uint64_t kCountMask     = (std::uint64_t(1) << 31) - 1;
+
+            breaker_options options_;
+
+            std::atomic<std::uint64_t> state_;
+
+            /* In microseconds of the steady clock */
+            std::atomic<std::int64_t> window_;
+            std::atomic<std::int64_t> opened_;
+    };
+
+    /*
+     * How a `grpc_client` spreads its calls over channels.
+     *
+     * Each channel gets its own sub-channel pool, so they do not share connections. Calls are
+     * assigned round robin, or by the calling thread so a thread keeps to one channel. When the
+     * channel picked already has `streams_per_channel` calls in flight, another channel is opened
+     * (up to `max_channels`).
+     *
+     */
+    struct pool_options {
+
+            enum Policy {
+                kRoundRobin,
+                kPerThread,
+                kLeastLoaded
+            };
+
+            std::size_t channels = 1;
+
+            std::size_t max_channels = 1;
+
+            std::size_t streams_per_channel = 100;
+
+            Policy policy = kRoundRobin;
+
+            /* Weigh `kLeastLoaded` choices by the load servers report in trailing metadata */
+            bool server_load = false;
+
+            /* Give each channel its own circuit breaker */
+            std::optional<breaker_options> breaker = std::nullopt;
+
+            /* Start connecting each channel as soon as it is opened */
+            bool preconnect = true;
+    };
+
+    /*
+     * Joins the completions of several outbound calls into a single resumption.
+     *
+     * `pending_` starts one above the number of calls so completions that arrive while the calls
+     * are still being issued can not resume the awaiter early. If `quorum_` is set, the calls that
+     * are still running are cancelled once that many have succeeded, or once enough have failed
+     * that it can no longer be reached.
+     *
+     */
+    class join : public completion {
+
+        public:
+
+            join(std::size_t _calls, std::size_t _quorum) noexcept
+                : awaiter_(nullptr), calls_(_calls), quorum_(_quorum), pending_(_calls + 1),
+                  succeeded_(0), failed_(0)
+            { }
+
+            void
+            complete(bool _success, const resumer& _resume) noexcept override
+            {
+                if (quorum_)
+                {
+                    if (_success)
+                    {
+                        if (succeeded_.fetch_add(1, std::memory_order_relaxed) + 1 == quorum_)
+                        {
+                            cancel();
+                        }
+                    }
+                    else if (
+                        failed_.fetch_add(1, std::memory_order_relaxed) + 1 ==
+                        calls_ - quorum_ + 1)
+                    {
+                        cancel();
+                    }
+                }
+
+                if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) { _resume(awaiter_); }
+            }
+
+        protected:
+
+            /* Drop the issuing guard, true if every call has already finished */
+            inline bool
+            issued() noexcept
+            {
+                return pending_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+            }
+
+            virtual void
+            cancel() noexcept = 0;
+
+            void* awaiter_;
+
+        private:
+
+            const std::size_t calls_;
+            const std::size_t quorum_;
+
+            std::atomic<std::size_t> pending_;
+            std::atomic<std::size_t> succeeded_;
+            std::atomic<std::size_t> failed_;
+    };
+
+    /*
+     * Seeds the per thread generators of backoff jitter and channel choice. Unlike
+     * `std::random_device` it cannot throw, as they run where nothing may.
+     *
+     */
+    inline std::uint_fast32_t
+    thread_seed() noexcept
+    {
+        const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+        return static_cast<std::uint_fast32_t>(
+            std::hash<std::thread::id>{}(std::this_thread::get_id()) ^
+            static_cast<std::size_t>(now));
+    }
+
+    /*
+     * A token bucket that limits extra attempts, such as hedges, to a fraction of calls. Each call
+     * deposits `_ratio` of a token and each extra attempt withdraws a whole one, so extra load
+     * can not grow past that fraction however slow or broken the backends get. `_burst` caps the
+     * tokens that can be saved up.
+     *
+     */
+    class budget {
+
+        public:
+
+            budget(double _ratio, std::size_t _burst) noexcept
+                : deposit_(static_cast<std::int64_t>(_ratio * kScale)),
+                  max_(static_cast<std::int64_t>(_burst) * kScale), tokens_(max_)
+            { }
+
+            void
+            deposit() noexcept
+            {
+                auto tokens = tokens_.load(std::memory_order_relaxed);
+                do
+                {
+                    if (tokens >= max_) { return; }
+
+                } while (!tokens_.compare_exchange_weak(
+                    tokens,
+                    std::min(tokens + deposit_, max_),
+                    std::memory_order_relaxed));
+            }
+
+            bool
+            withdraw() noexcept
+            {
+                auto tokens = tokens_.load(std::memory_order_relaxed);
+                do
+                {
+                    if (tokens < kScale) { return false; }
+
+                } while (!tokens_.compare_exchange_weak(
+                    tokens,
+                    tokens - kScale,
+                    std::memory_order_relaxed));
+
+                return true;
+            }
+
+            double
+            available() const noexcept
+            {
+                return static_cast<double>(tokens_.load(std::memory_order_relaxed)) / kScale;
+            }
+
+        private:
+
+            static constexpr std::int64_t kScale = 1000;
+
+            const std::int64_t deposit_;
+            const std::int64_t max_;
+
+            std::atomic<std::int64_t> tokens_;
+    };
+
+    struct hedge_options {
+
+            /* The latency percentile after which a hedge is sent */
+            double percentile = 0.95;
+
+            std::chrono::microseconds min_delay{500};
+
+            std::chrono::microseconds max_delay{1000000};
+    };
+
+    /*
+     * When to hedge calls to one method.
+     *
+     * Keeps a histogram of the latency of the calls made through it and hedges once a call has
+     * taken longer than `percentile` of them. The histogram has four buckets per power of two
+     * microseconds and is halved every so often so it follows recent latency. The delay is
+     * recomputed every `kRefresh` samples rather than per call. Hedges are withdrawn from
+     * `_budget`, which can be shared between policies to cap hedging across the whole client.
+     *
+     */
+    class hedge_policy {
+
+        public:
+
+            hedge_policy(budget& _budget, hedge_options _options = {}) noexcept
+                : budget_(_budget), options_(_options), delay_(_options.max_delay.count()),
+                  samples_(0)
+            {
+                for (auto& bucket : buckets_)
+                {
+                    bucket.store(0, std::memory_order_relaxed);
+                }
+            }
+
+            inline std::chrono::microseconds
+            delay() const noexcept
+            {
+                return std::chrono::microseconds(delay_.load(std::memory_order_relaxed));
+            }
+
+            inline budget&
+            tokens() noexcept
+            {
+                return budget_;
+            }
+
+            void
+            record(std::chrono::microseconds _latency) noexcept
+            {
+                buckets_[bucket(static_cast<std::uint64_t>(std::max<std::int64_t>(
+                             _latency.count(),
+                             0)))]
+                    .fetch_add(1, std::memory_order_relaxed);
+
+                if ((samples_.fetch_add(1, std::memory_order_relaxed) + 1) % kRefresh == 0)
+                {
+                    refresh();
+                }
+            }
+
+        private:
+
+            static constexpr std::size_t kBuckets = 128;
+            static constexpr std::size_t kRefresh = 64;
+            static constexpr std::size_t kDecay   = 8192;
+
+            static inline std::size_t
+            bucket(std::uint64_t _micros) noexcept
+            {
+                if (_micros < 4) { return _micros; }
+
+                const std::size_t msb = std::bit_width(_micros) - 1;
+                const std::size_t sub = (_micros >> (msb - 2)) & 0b11;
+                return std::min((msb - 1) * 4 + sub, kBuckets - 1);
+            }
+
+            static inline std::uint64_t
+            lower_bound(std::size_t _bucket) noexcept
+            {
+                if (_bucket < 4) { return _bucket; }
+
+                return (4 + _bucket % 4) << (_bucket / 4 - 1);
+            }
+
+            void
+            refresh() noexcept
+            {
+                std::uint64_t total = 0;
+                for (auto& bucket : buckets_)
+                {
+                    total += bucket.load(std::memory_order_relaxed);
+                }
+
+                const auto target = static_cast<std::uint64_t>(total * options_.percentile);
+
+                std::uint64_t seen  = 0;
+                std::size_t   index = 0;
+                for (; index < kBuckets - 1; ++index)
+                {
+                    seen += buckets_[index].load(std::memory_order_relaxed);
+                    if (seen > target) { break; }
+                }
+
+                /* Use the top of the bucket so we err towards hedging less */
+                const auto micros = std::clamp<std::int64_t>(
+                    static_cast<std::int64_t>(lower_bound(index + 1)),
+                    options_.min_delay.count(),
+                    options_.max_delay.count());
+
+                delay_.store(micros, std::memory_order_relaxed);
+
+                /* Not exact under concurrent records, but close enough for a percentile */
+                if (total > kDecay)
+                {
+                    for (auto& bucket : buckets_)
+                    {
+                        bucket.store(
+                            bucket.load(std::memory_order_relaxed) / 2,
+                            std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            budget& budget_;
+
+            hedge_options options_;
+
+            std::atomic<std::int64_t> delay_;
+
+            std::atomic<std::uint64_t> samples_;
+
+            std::array<std::atomic<std::uint64_t>, kBuckets> buckets_;
+    };
+
+    struct retry_options {
+
+            /* Including the first */
+            std::size_t max_attempts = 3;
+
+            std::chrono::microseconds initial_backoff{10000};
+
+            std::chrono::microseconds max_backoff{1000000};
+
+            double multiplier = 2.0;
+
+            /* Bit `1 << code` is set for each `grpc::StatusCode` worth retrying */
+            std::uint32_t retryable = 1u << grpc::StatusCode::UNAVAILABLE;
+    };
+
+    /*
+     * Counters of a `retry_policy`.
+     *
+     */
+    struct retry_stats {
+
+            std::uint64_t calls;
+
+            std::uint64_t retries;
+
+            /* Retries the budget did not allow */
+            std::uint64_t throttled;
+
+            /* Calls that failed with a retryable code on their last attempt */
+            std::uint64_t exhausted;
+    };
+
+    /*
+     * When and how soon to retry calls that failed.
+     *
+     * Only codes in `retryable` are retried. The wait before attempt `n` is drawn uniformly from
+     * zero up to `initial_backoff * multiplier^n`, capped at `max_backoff`, so retries from many
+     * callers do not line up. Retries are withdrawn from `_budget`, which should be shared by all
+     * policies for the same endpoint so a brownout can not be multiplied by retries.
+     *
+     */
+    class retry_policy {
+
+        public:
+
+            retry_policy(budget& _budget, retry_options _options = {}) noexcept
+                : budget_(_budget), options_(_options), calls_(0), retries_(0), throttled_(0),
+                  exhausted_(0)
+            { }
+
+            inline budget&
+            tokens() noexcept
+            {
+                return budget_;
+            }
+
+            inline const retry_options&
+            options() const noexcept
+            {
+                return options_;
+            }
+
+            retry_stats
+            stats() const noexcept
+            {
+                return retry_stats{
+                    .calls     = calls_.load(std::memory_order_relaxed),
+                    .retries   = retries_.load(std::memory_order_relaxed),
+                    .throttled = throttled_.load(std::memory_order_relaxed),
+                    .exhausted = exhausted_.load(std::memory_order_relaxed)};
+            }
+
+            /*
+             * Called as attempt `_attempt` (from one) failed with `_code`. Returns whether another
+             * attempt should be made.
+             *
+             */
+            bool
+            should_retry(grpc::StatusCode _code, std::size_t _attempt) noexcept
+            {
+                if (!(options_.retryable & (1u << _code))) { return false; }
+
+                if (_attempt >= options_.max_attempts)
+                {
+                    exhausted_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+
+                if (!budget_.withdraw())
+                {
+                    throttled_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+
+                retries_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+
+            std::chrono::microseconds
+            backoff(std::size_t _attempt) noexcept
+            {
+                auto cap = static_cast<double>(options_.initial_backoff.count());
+                for (std::size_t i = 1; i < _attempt && cap < options_.max_backoff.count(); ++i)
+                {
+                    cap *= options_.multiplier;
+                }
+
+                cap = std::min(cap, static_cast<double>(options_.max_backoff.count()));
+
+                static thread_local std::minstd_rand random(thread_seed());
+                return std::chrono::microseconds(static_cast<std::int64_t>(
+                    std::uniform_real_distribution<double>(0, cap)(random)));
+            }
+
+            inline void
+            started() noexcept
+            {
+                calls_.fetch_add(1, std::memory_order_relaxed);
+                budget_.deposit();
+            }
+
+        private:
+
+            budget& budget_;
+
+            retry_options options_;
+
+            std::atomic<std::uint64_t> calls_;
+            std::atomic<std::uint64_t> retries_;
+            std::atomic<std::uint64_t> throttled_;
+            std::atomic<std::uint64_t> exhausted_;
+    };
+
+    template <typename Stub, typename Executer>
+    class grpc_client {
+
+        public:
+
+            template <typename Request, typename Response>
+            using unary_method = std::unique_ptr<grpc::ClientAsyncResponseReader<Response>> (
+                Stub::*)(grpc::ClientContext*, const Request&, grpc::CompletionQueue*);
+
+            template <typename Request, typename Response>
+            using stream_method = std::unique_ptr<grpc::ClientAsyncReader<Response>> (
+                Stub::*)(grpc::ClientContext*, const Request&, grpc::CompletionQueue*);
+
+            /*
+             * A channel and what is known about how loaded it is.
+             *
+             * The latency is a moving average in microseconds. Completions of a client are drained
+             * by a single thread so it is the only writer of it and of the reported load.
+             *
+             */
+            struct endpoint {
+
+                    /*
+                     * The cost of adding a call. The latency is scaled by the calls that would be
+                     * ahead of it, locally and as last reported by the server.
+                     *
+                     */
+                    std::uint64_t
+                    cost() const noexcept
+                    {
+                        const auto latency = latency_.load(std::memory_order_relaxed) +
+                                             delay_.load(std::memory_order_relaxed);
+                        const auto ahead   = in_flight_.load(std::memory_order_relaxed) +
+                                           queued_.load(std::memory_order_relaxed);
+
+                        /* Until there is a sample only the calls ahead count */
+                        return (latency + 1) * (ahead + 1);
+                    }
+
+                    /* Failures count as twice the average so a failing channel is not favoured */
+                    void
+                    observe(std::chrono::steady_clock::duration _latency, bool _failed) noexcept
+                    {
+                        auto sample = static_cast<std::uint64_t>(
+                            std::chrono::duration_cast<std::chrono::microseconds>(_latency)
+                                .count());
+
+                        auto latency = latency_.load(std::memory_order_relaxed);
+                        if (_failed) { sample = std::max(sample, latency * 2); }
+
+                        latency      = latency ? latency - latency / kDecay + sample / kDecay
+                                               : sample;
+                        latency_.store(latency, std::memory_order_relaxed);
+                    }
+
+                    template <typename Context>
+                    void
+                    report(const Context& _context) noexcept
+                    {
+                        using trailers_type =
+                            std::remove_cvref_t<decltype(_context.GetServerTrailingMetadata())>;
+                        using key_type = typename trailers_type::key_type;
+
+                        const auto& trailers = _context.GetServerTrailingMetadata();
+                        const auto  it =
+                            trailers.find(key_type(kLoadReportKey.data(), kLoadReportKey.size()));
+                        if (it == trailers.end()) { return; }
+
+                        std::array<std::uint64_t, 3> fields{};
+
+                        const char* at  = it->second.data();
+                        const char* end = at + it->second.size();
+                        for (auto& field : fields)
+                        {
+                            const auto [ptr, ec] = std::from_chars(at, end, field);
+                            if (ec != std::errc()) { return; }
+
+                            at = ptr + (ptr != end && *ptr == ',');
+                        }
+
+                        queued_.store(fields[1], std::memory_order_relaxed);
+                        delay_.store(fields[2], std::memory_order_relaxed);
+                    }
+
+                    static constexpr std::uint64_t kDecay = 8;
+
+                    std::shared_ptr<grpc::Channel> channel_;
+
+                    std::unique_ptr<Stub> stub_;
+
+                    std::atomic<std::size_t> in_flight_{0};
+
+                    std::atomic<std::uint64_t> latency_{0};
+
+                    std::atomic<std::uint64_t> queued_{0};
+
+                    std::atomic<std::uint64_t> delay_{0};
+
+                    circuit_breaker breaker_;
+
+                    bool reports_ = false;
+
+                    bool breaking_ = false;
+            };
+
+            /*
+             * The completion queue tag of an outbound call.
+             *
+             * These are pooled by the client. The context is rebuilt for every call since grpc does
+             * not allow a `grpc::ClientContext` to be reused. A context derived from a server
+             * context can only be made by grpc, so those are held apart in `derived_`.
+             *
+             */
+            class call_data : public completion {
+
+                    friend class grpc_client;
+
+                public:
+
+                    call_data()
+                        : next_(nullptr), awaiter_(nullptr), parent_(nullptr), status_(nullptr),
+                          endpoint_(nullptr), ok_(false), probe_(false)
+                    { }
+
+                    inline grpc::ClientContext&
+                    context() noexcept
+                    {
+                        return derived_ ? *derived_ : *ctx_;
+                    }
+
+                private:
+
+                    void
+                    complete(bool _ok, const resumer& _resume) noexcept override
+                    {
+                        /* Rejected by every circuit, and posted back through the queue */
+                        if (!endpoint_)
+                        {
+                            parent_->complete(false, _resume);
+                            return;
+                        }
+
+                        ok_ = _ok;
+                        endpoint_->in_flight_.fetch_sub(1, std::memory_order_relaxed);
+
+                        const auto latency = std::chrono::steady_clock::now() - started_;
+
+                        endpoint_->observe(latency, !_ok || !status_->ok());
+                        if (_ok && endpoint_->reports_) { endpoint_->report(context()); }
+                        if (endpoint_->breaking_)
+                        {
+                            endpoint_->breaker_.record(
+                                _ok,
+                                status_->error_code(),
+                                latency,
+                                probe_);
+                        }
+
+                        /* The parent may release this call, so this must be last */
+                        if (parent_) { parent_->complete(_ok && status_->ok(), _resume); }
+                        else
+                        {
+                            _resume(awaiter_);
+                        }
+                    }
+
+                    std::optional<grpc::ClientContext> ctx_;
+
+                    std::unique_ptr<grpc::ClientContext> derived_;
+
+                    call_data* next_;
+
+                    void*         awaiter_;
+                    completion*   parent_;
+                    grpc::Status* status_;
+
+                    endpoint* endpoint_;
+
+                    std::chrono::steady_clock::time_point started_;
+
+                    /* Made on the first rejection that has a parent, then kept with the call */
+                    std::optional<grpc::Alarm> alarm_;
+
+                    bool ok_;
+
+                    /* Decides the state of a half open circuit */
+                    bool probe_;
+            };
+
+            template <typename Request, typename Response>
+            class call_proxy {
+
+                public:
+
+                    using response_type = Response;
+
+                    call_proxy(
+                        grpc_client*                    _self,
+                        call_data*                      _call,
+                        unary_method<Request, Response> _method,
+                        const Request&                  _request)
+                        : self_(_self), call_(_call), method_(_method), request_(&_request)
+                    { }
+
+                    call_proxy(const call_proxy&) = delete;
+
+                    /* Only valid before the call is started */
+                    call_proxy(call_proxy&& _move) noexcept
+                        : self_(_move.self_), call_(std::exchange(_move.call_, nullptr)),
+                          method_(_move.method_), request_(_move.request_)
+                    { }
+
+                    ~call_proxy()
+                    {
+                        if (call_) { self_->release(call_); }
+                    }
+
+                    bool
+                    await_ready() const noexcept
+                    {
+                        return false;
+                    }
+
+                    bool
+                    await_suspend(std::coroutine_handle<> _awaiter) noexcept
+                    {
+                        call_->awaiter_ = _awaiter.address();
+                        return start();
+                    }
+
+                    reply<Response>
+                    await_resume() noexcept
+                    {
+                        return finish();
+                    }
+
+                    inline grpc::ClientContext&
+                    context() noexcept
+                    {
+                        return call_->context();
+                    }
+
+                    /* The channel the call was started on */
+                    inline const endpoint*
+                    target() const noexcept
+                    {
+                        return call_->endpoint_;
+                    }
+
+                    /*
+                     * Report the completion to `_parent` instead of resuming an awaiter. It is
+                     * completed with whether the call succeeded.
+                     *
+                     */
+                    inline void
+                    join_with(completion* _parent) noexcept
+                    {
+                        call_->parent_ = _parent;
+                    }
+
+                    /*
+                     * Start the call, on a channel other than `_avoid` if there is one. False if
+                     * every circuit is open, in which case the call has already failed. A joined
+                     * call still reports the failure to its parent through the completion queue.
+                     *
+                     */
+                    bool
+                    start(const endpoint* _avoid = nullptr) noexcept
+                    {
+                        call_->status_ = &reply_.status;
+
+                        bool  probe  = false;
+                        auto* target = self_->pick(_avoid, probe);
+                        if (!target) { return reject(); }
+
+                        /* Before it starts, as it can complete at once */
+                        call_->probe_ = probe;
+                        start_on(target);
+                        return true;
+                    }
+
+                    /* Start the call on `_target`, whatever the state of its circuit */
+                    void
+                    start_on(endpoint* _target) noexcept
+                    {
+                        call_->status_   = &reply_.status;
+                        call_->endpoint_ = _target;
+                        call_->endpoint_->in_flight_.fetch_add(1, std::memory_order_relaxed);
+                        call_->started_ = std::chrono::steady_clock::now();
+
+                        reader_ = (call_->endpoint_->stub_.get()->*method_)(
+                            &call_->context(),
+                            *request_,
+                            self_->queue_);
+
+                        /* May complete before returning */
+                        reader_->Finish(&reply_.message, &reply_.status, call_->tag());
+                    }
+
+                    reply<Response>
+                    finish() noexcept
+                    {
+                        /* The reader lives in the calls arena so it must go first */
+                        reader_.reset();
+
+                        if (!call_->ok_ && reply_.status.ok())
+                        {
+                            reply_.status = grpc::Status(grpc::StatusCode::CANCELLED, "");
+                        }
+
+                        self_->release(std::exchange(call_, nullptr));
+                        return std::move(reply_);
+                    }
+
+                private:
+
+                    bool
+                    reject() noexcept
+                    {
+                        reply_.status = grpc::Status(grpc::StatusCode::UNAVAILABLE, "circuit open");
+                        call_->ok_    = true;
+
+                        /*
+                         * An awaiter is simply not suspended. A parent is completed by whoever
+                         * drains the queue, as for any other call, so it is neither resumed on
+                         * the wrong executor nor re-entered from within its own launch.
+                         */
+                        if (call_->parent_)
+                        {
+                            if (!call_->alarm_) { call_->alarm_.emplace(); }
+                            call_->alarm_->Set(
+                                &self_->completion_queue(),
+                                std::chrono::system_clock::now(),
+                                call_->tag());
+                        }
+
+                        return false;
+                    }
+
+                    grpc_client* self_;
+
+                    call_data* call_;
+
+                    unary_method<Request, Response> method_;
+
+                    const Request* request_;
+
+                    std::unique_ptr<grpc::ClientAsyncResponseReader<Response>> reader_;
+
+                    reply<Response> reply_;
+            };
+
+            /*
+             * A unary call that is sent a second time if the first has not finished within the
+             * delay of its `hedge_policy`. The first success wins and the other attempt is
+             * cancelled. Like `when_any`, the awaiter is resumed once every attempt has drained.
+             *
+             */
+            template <typename Request, typename Response, typename Configure>
+            class hedge_proxy : public completion {
+
+                public:
+
+                    hedge_proxy(
+                        grpc_client*                    _self,
+                        hedge_policy&                   _policy,
+                        unary_method<Request, Response> _method,
+                        const Request&                  _request,
+                        Configure                       _configure)
+                        : self_(_self), policy_(_policy), method_(_method), request_(&_request),
+                          configure_(std::move(_configure)), attempts_{{this, 0}, {this, 1}},
+                          awaiter_(nullptr), pending_(0), winner_(-1), primary_done_(false),
+                          armed_(false)
+                    { }
+
+                    hedge_proxy(const hedge_proxy&) = delete;
+
+                    bool
+                    await_ready() const noexcept
+                    {
+                        return false;
+                    }
+
+                    bool
+                    await_suspend(std::coroutine_handle<> _awaiter) noexcept
+                    {
+                        awaiter_ = _awaiter.address();
+
+                        policy_.tokens().deposit();
+
+                        /* The primary, the alarm and the issuing guard */
+                        pending_.store(3, std::memory_order_relaxed);
+
+                        /* The hedge reads the primary, so it is in place before the alarm */
+                        launch(0, nullptr);
+
+                        alarm_.Set(
+                            &self_->completion_queue(),
+                            std::chrono::system_clock::now() + policy_.delay(),
+                            tag());
+
+                        /* A primary that finished before the alarm was set could not cancel it */
+                        armed_.store(true, std::memory_order_seq_cst);
+                        if (primary_done_.load(std::memory_order_seq_cst)) { alarm_.Cancel(); }
+
+                        return pending_.fetch_sub(1, std::memory_order_acq_rel) != 1;
+                    }
+
+                    reply<Response>
+                    await_resume() noexcept
+                    {
+                        auto primary = calls_[0]->finish();
+                        if (!calls_[1]) { return primary; }
+
+                        auto hedge = calls_[1]->finish();
+                        return winner_.load(std::memory_order_relaxed) == 1 ? std::move(hedge)
+                                                                            : std::move(primary);
+                    }
+
+                private:
+
+                    struct attempt : public completion {
+
+                            attempt(hedge_proxy* _self, int _index) : self_(_self), index_(_index)
+                            { }
+
+                            void
+                            complete(bool _success, const resumer& _resume) noexcept override
+                            {
+                                self_->finished(index_, _success, _resume);
+                            }
+
+                            hedge_proxy* self_;
+
+                            int index_;
+                    };
+
+                    /* The hedge delay passed, or the alarm was cancelled */
+                    void
+                    complete(bool _ok, const resumer& _resume) noexcept override
+                    {
+                        if (_ok && !primary_done_.load(std::memory_order_relaxed) &&
+                            winner_.load(std::memory_order_relaxed) < 0 &&
+                            policy_.tokens().withdraw())
+                        {
+                            pending_.fetch_add(1, std::memory_order_relaxed);
+                            launch(1, calls_[0]->target());
+                        }
+
+                        arrive(_resume);
+                    }
+
+                    void
+                    finished(int _index, bool _success, const resumer& _resume) noexcept
+                    {
+                        if (_index == 0)
+                        {
+                            primary_done_.store(true, std::memory_order_seq_cst);
+                            if (armed_.load(std::memory_order_seq_cst)) { alarm_.Cancel(); }
+                        }
+
+                        /*
+                         * The policy wants the latency of a single call, so each attempt is
+                         * timed from its own start. A primary cancelled for the hedge is
+                         * recorded as far as it got, so slow primaries are not left out.
+                         *
+                         */
+                        const bool overtaken =
+                            _index == 0 && winner_.load(std::memory_order_relaxed) == 1;
+                        if (_success || overtaken)
+                        {
+                            policy_.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                                std::chrono::steady_clock::now() - started_[_index]));
+                        }
+
+                        int none = -1;
+                        if (_success && winner_.compare_exchange_strong(
+                                            none,
+                                            _index,
+                                            std::memory_order_relaxed))
+                        {
+                            const int other = 1 - _index;
+                            if (calls_[other]) { calls_[other]->context().TryCancel(); }
+                        }
+
+                        arrive(_resume);
+                    }
+
+                    void
+                    launch(int _index, const endpoint* _avoid) noexcept
+                    {
+                        calls_[_index].emplace(self_->call(method_, *request_));
+                        configure_(calls_[_index]->context());
+                        calls_[_index]->join_with(&attempts_[_index]);
+
+                        started_[_index] = std::chrono::steady_clock::now();
+
+                        /* May complete before returning */
+                        calls_[_index]->start(_avoid);
+                    }
+
+                    void
+                    arrive(const resumer& _resume) noexcept
+                    {
+                        if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        {
+                            _resume(awaiter_);
+                        }
+                    }
+
+                    grpc_client* self_;
+
+                    hedge_policy& policy_;
+
+                    unary_method<Request, Response> method_;
+
+                    const Request* request_;
+
+                    Configure configure_;
+
+                    std::optional<call_proxy<Request, Response>> calls_[2];
+
+                    attempt attempts_[2];
+
+                    grpc::Alarm alarm_;
+
+                    void* awaiter_;
+
+                    std::chrono::steady_clock::time_point started_[2];
+
+                    std::atomic<std::size_t> pending_;
+
+                    std::atomic<int> winner_;
+
+                    /* The primary can finish on a queue thread before the alarm is armed */
+                    std::atomic<bool> primary_done_;
+                    std::atomic<bool> armed_;
+            };
+
+            /*
+             * A unary call that is attempted again after a jittered backoff if it fails with a
+             * retryable code. The backoff is a `grpc::Alarm` on the clients queue, so no thread
+             * waits for it.
+             *
+             */
+            template <typename Request, typename Response, typename Configure>
+            class retry_proxy : public completion {
+
+                public:
+
+                    retry_proxy(
+                        grpc_client*                    _self,
+                        retry_policy&                   _policy,
+                        unary_method<Request, Response> _method,
+                        const Request&                  _request,
+                        Configure                       _configure)
+                        : self_(_self), policy_(_policy), method_(_method), request_(&_request),
+                          configure_(std::move(_configure)), attempt_(this), awaiter_(nullptr),
+                          attempts_(0)
+                    { }
+
+                    retry_proxy(const retry_proxy&) = delete;
+
+                    bool
+                    await_ready() const noexcept
+                    {
+                        return false;
+                    }
+
+                    void
+                    await_suspend(std::coroutine_handle<> _awaiter) noexcept
+                    {
+                        awaiter_ = _awaiter.address();
+                        policy_.started();
+                        launch();
+                    }
+
+                    reply<Response>
+                    await_resume() noexcept
+                    {
+                        return std::move(*result_);
+                    }
+
+                private:
+
+                    struct attempt : public completion {
+
+                            attempt(retry_proxy* _self) : self_(_self) { }
+
+                            void
+                            complete(bool _success, const resumer& _resume) noexcept override
+                            {
+                                self_->finished(_success, _resume);
+                            }
+
+                            retry_proxy* self_;
+                    };
+
+                    /* The backoff passed, or the alarm was cancelled as the queue shut down */
+                    void
+                    complete(bool _ok, const resumer& _resume) noexcept override
+                    {
+                        if (_ok) { launch(); }
+                        else
+                        {
+                            _resume(awaiter_);
+                        }
+                    }
+
+                    void
+                    finished(bool _success, const resumer& _resume) noexcept
+                    {
+                        /* Rejected by an open circuit, so no server was reached */
+                        const bool rejected = !call_->target();
+
+                        result_ = call_->finish();
+                        call_.reset();
+
+                        if (!_success && !rejected &&
+                            policy_.should_retry(result_->status.error_code(), attempts_))
+                        {
+                            alarm_.Set(
+                                &self_->completion_queue(),
+                                std::chrono::system_clock::now() + policy_.backoff(attempts_),
+                                tag());
+                        }
+                        else
+                        {
+                            _resume(awaiter_);
+                        }
+                    }
+
+                    void
+                    launch() noexcept
+                    {
+                        ++attempts_;
+                        call_.emplace(self_->call(method_, *request_));
+                        configure_(call_->context());
+                        call_->join_with(&attempt_);
+
+                        /* May complete before returning */
+                        call_->start();
+                    }
+
+                    grpc_client* self_;
+
+                    retry_policy& policy_;
+
+                    unary_method<Request, Response> method_;
+
+                    const Request* request_;
+
+                    Configure configure_;
+
+                    std::optional<call_proxy<Request, Response>> call_;
+
+                    std::optional<reply<Response>> result_;
+
+                    attempt attempt_;
+
+                    grpc::Alarm alarm_;
+
+                    void* awaiter_;
+
+                    std::size_t attempts_;
+            };
+
+            /*
+             * Waits for every channel open when it was made to connect, or for `_deadline`. It
+             * resumes with whether all of them did.
+             *
+             * Each channel is watched on the completion queue with `NotifyOnStateChange`, asking it
+             * to connect each time its state is checked. The first check is also made from the
+             * queue, through an alarm that goes off at once, so every check runs on the thread
+             * draining it and resumes through its executer. Once a channel is ready it is handed
+             * to `warm`, which reports it done.
+             *
+             */
+            class ready_proxy : public join {
+
+                public:
+
+                    ready_proxy(grpc_client* _self, std::chrono::system_clock::time_point _deadline)
+                        : join(_self->channels(), 0), self_(_self), deadline_(_deadline),
+                          watches_(std::make_unique<watch[]>(_self->channels())),
+                          size_(_self->channels()), failed_(0)
+                    { }
+
+                    ready_proxy(const ready_proxy&) = delete;
+
+                    bool
+                    await_ready() const noexcept
+                    {
+                        return false;
+                    }
+
+                    bool
+                    await_suspend(std::coroutine_handle<> _awaiter) noexcept
+                    {
+                        awaiter_ = _awaiter.address();
+
+                        const auto now = std::chrono::system_clock::now();
+                        for (std::size_t i = 0; i < size_; ++i)
+                        {
+                            watches_[i].self_     = this;
+                            watches_[i].endpoint_ = &self_->endpoints_[i];
+                            watches_[i].index_    = i;
+
+                            watches_[i].alarm_.Set(
+                                &self_->completion_queue(),
+                                now,
+                                watches_[i].tag());
+                        }
+
+                        return !issued();
+                    }
+
+                    bool
+                    await_resume() noexcept
+                    {
+                        return failed_.load(std::memory_order_relaxed) == 0;
+                    }
+
+                protected:
+
+                    struct watch : public completion {
+
+                            void
+                            complete(bool _ok, const resumer& _resume) noexcept override
+                            {
+                                if (warming_) { self_->warmed(*this, _ok, _resume); }
+                                else
+                                {
+                                    self_->check(*this, _ok, _resume);
+                                }
+                            }
+
+                            ready_proxy* self_ = nullptr;
+
+                            endpoint* endpoint_ = nullptr;
+
+                            std::size_t index_ = 0;
+
+                            /* Set once connected, when completions are of warm up calls */
+                            bool warming_ = false;
+
+                            std::atomic<std::size_t> pending_{0};
+
+                            std::atomic<bool> failed_{false};
+
+                            /* Goes off at once, for the first check */
+                            grpc::Alarm alarm_;
+                    };
+
+                    /* The channel of `_watch` is ready */
+                    virtual void
+                    warm([[maybe_unused]] watch& _watch, const resumer& _resume) noexcept
+                    {
+                        done(true, _resume);
+                    }
+
+                    /* A warm up call on the channel of `_watch` finished */
+                    void
+                    warmed(watch& _watch, bool _success, const resumer& _resume) noexcept
+                    {
+                        if (!_success) { _watch.failed_.store(true, std::memory_order_relaxed); }
+
+                        if (_watch.pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        {
+                            done(!_watch.failed_.load(std::memory_order_relaxed), _resume);
+                        }
+                    }
+
+                    void
+                    done(bool _success, const resumer& _resume) noexcept
+                    {
+                        if (!_success) { failed_.fetch_add(1, std::memory_order_relaxed); }
+
+                        join::complete(_success, _resume);
+                    }
+
+                    grpc_client* self_;
+
+                    std::chrono::system_clock::time_point deadline_;
+
+                private:
+
+                    /* `_ok` is false once the deadline has passed, or the queue is shutting down */
+                    void
+                    check(watch& _watch, bool _ok, const resumer& _resume) noexcept
+                    {
+                        auto& channel = *_watch.endpoint_->channel_;
+
+                        const auto state = channel.GetState(true);
+                        if (state == GRPC_CHANNEL_READY)
+                        {
+                            _watch.warming_ = true;
+                            warm(_watch, _resume);
+                        }
+                        else if (!_ok || state == GRPC_CHANNEL_SHUTDOWN)
+                        {
+                            done(false, _resume);
+                        }
+                        else
+                        {
+                            channel.NotifyOnStateChange(
+                                state,
+                                deadline_,
+                                &self_->completion_queue(),
+                                _watch.tag());
+                        }
+                    }
+
+                    void
+                    cancel() noexcept override
+                    { }
+
+                    std::unique_ptr<watch[]> watches_;
+
+                    std::size_t size_;
+
+                    std::atomic<std::size_t> failed_;
+            };
+
+            /*
+             * As `ready_proxy`, but each channel is only done once `_per_channel` calls of
+             * `_method` have been made on it, so it is hot before real calls arrive.
+             *
+             */
+            template <typename Request, typename Response>
+            class warm_proxy : public ready_proxy {
+
+                public:
+
+                    warm_proxy(
+                        grpc_client*                          _self,
+                        std::chrono::system_clock::time_point _deadline,
+                        unary_method<Request, Response>       _method,
+                        const Request&                        _request,
+                        std::size_t                           _per_channel)
+                        : ready_proxy(_self, _deadline), method_(_method), request_(&_request),
+                          per_channel_(std::max<std::size_t>(_per_channel, 1)),
+                          calls_(_self->channels() * per_channel_)
+                    { }
+
+                    bool
+                    await_resume() noexcept
+                    {
+                        for (auto& call : calls_)
+                        {
+                            if (call) { call->finish(); }
+                        }
+
+                        return ready_proxy::await_resume();
+                    }
+
+                private:
+
+                    using watch = typename ready_proxy::watch;
+
+                    void
+                    warm(watch& _watch, const completion::resumer& _resume) noexcept override
+                    {
+                        /* The calls and the issuing guard */
+                        _watch.pending_.store(per_channel_ + 1, std::memory_order_relaxed);
+
+                        for (std::size_t i = 0; i < per_channel_; ++i)
+                        {
+                            auto& call = calls_[_watch.index_ * per_channel_ + i];
+                            call.emplace(this->self_->call(method_, *request_));
+                            call->join_with(&_watch);
+
+                            /* A backend that connects and then stalls must not outlast it */
+                            call->context().set_deadline(this->deadline_);
+
+                            /* May complete before returning */
+                            call->start_on(_watch.endpoint_);
+                        }
+
+                        this->warmed(_watch, true, _resume);
+                    }
+
+                    unary_method<Request, Response> method_;
+
+                    const Request* request_;
+
+                    std::size_t per_channel_;
+
+                    std::vector<std::optional<call_proxy<Request, Response>>> calls_;
+            };
+
+            /*
+             * Reads a server stream as an asynchronous generator:
+             *
+             *     while (auto* message = co_await stream.next()) { ... }
+             *
+             * The stream starts on the first `next()`. Once a message is handed out the read of
+             * the one after it is started, so it arrives while the current one is processed. The
+             * two messages are read into alternately, so a message is only valid until the next
+             * `next()`.
+             *
+             * The state is shared with the completion queue, so a stream dropped before its end is
+             * cancelled and cleans up once its last operation has drained.
+             *
+             */
+            template <typename Request, typename Response>
+            class stream_reader {
+
+                    class state;
+
+                public:
+
+                    class next_proxy {
+
+                        public:
+
+                            explicit next_proxy(state* _state) noexcept : state_(_state) { }
+
+                            bool
+                            await_ready() const noexcept
+                            {
+                                state_->start();
+                                return state_->ready();
+                            }
+
+                            bool
+                            await_suspend(std::coroutine_handle<> _awaiter) noexcept
+                            {
+                                return state_->wait(_awaiter.address());
+                            }
+
+                            Response*
+                            await_resume() noexcept
+                            {
+                                return state_->take();
+                            }
+
+                        private:
+
+                            state* state_;
+                    };
+
+                    stream_reader(
+                        grpc_client*                     _self,
+                        stream_method<Request, Response> _method,
+                        const Request&                   _request)
+                        : state_(new state(_self, _method, _request))
+                    { }
+
+                    stream_reader(const stream_reader&) = delete;
+
+                    stream_reader(stream_reader&& _move) noexcept
+                        : state_(std::exchange(_move.state_, nullptr))
+                    { }
+
+                    ~stream_reader()
+                    {
+                        if (state_) { state_->abandon(); }
+                    }
+
+                    /* Resumes with the next message, or nullptr once the stream is over */
+                    next_proxy
+                    next() noexcept
+                    {
+                        return next_proxy(state_);
+                    }
+
+                    inline grpc::ClientContext&
+                    context() noexcept
+                    {
+                        return state_->ctx_;
+                    }
+
+                    /* How the stream ended, once `next()` has returned nullptr */
+                    inline const grpc::Status&
+                    status() const noexcept
+                    {
+                        return state_->status_;
+                    }
+
+                private:
+
+                    class state : public completion {
+
+                            friend class stream_reader;
+
+                        public:
+
+                            state(
+                                grpc_client*                     _self,
+                                stream_method<Request, Response> _method,
+                                const Request&                   _request)
+                                : self_(_self), method_(_method), request_(&_request),
+                                  endpoint_(nullptr), awaiter_(nullptr), op_(kStart), fill_(0),
+                                  started_(false), ended_(false), probe_(false), signal_(kIdle),
+                                  refs_(1)
+                            { }
+
+                            /* Only the consumer calls these */
+                            void
+                            start() noexcept
+                            {
+                                if (std::exchange(started_, true)) { return; }
+
+                                endpoint_ = self_->pick(nullptr, probe_);
+                                if (!endpoint_)
+                                {
+                                    status_ = grpc::Status(
+                                        grpc::StatusCode::UNAVAILABLE,
+                                        "circuit open");
+                                    ended_ = true;
+                                    signal_.store(kReady, std::memory_order_relaxed);
+                                    return;
+                                }
+
+                                endpoint_->in_flight_.fetch_add(1, std::memory_order_relaxed);
+                                refs_.fetch_add(1, std::memory_order_relaxed);
+
+                                /* Stored before it starts, the start can complete at once */
+                                op_     = kStart;
+                                reader_ = (endpoint_->stub_.get()->*method_)(
+                                    &ctx_,
+                                    *request_,
+                                    &self_->completion_queue());
+                                reader_->StartCall(tag());
+                            }
+
+                            bool
+                            ready() const noexcept
+                            {
+                                return signal_.load(std::memory_order_acquire) == kReady;
+                            }
+
+                            /* False if the result arrived first */
+                            bool
+                            wait(void* _awaiter) noexcept
+                            {
+                                awaiter_ = _awaiter;
+
+                                auto idle = kIdle;
+                                return signal_.compare_exchange_strong(
+                                    idle,
+                                    kWaiting,
+                                    std::memory_order_acq_rel,
+                                    std::memory_order_acquire);
+                            }
+
+                            Response*
+                            take() noexcept
+                            {
+                                if (ended_) { return nullptr; }
+
+                                const auto current = fill_;
+                                fill_ ^= 1;
+
+                                /* Must be idle before the next read can complete */
+                                signal_.store(kIdle, std::memory_order_relaxed);
+
+                                op_ = kRead;
+                                reader_->Read(&messages_[fill_], tag());
+
+                                return &messages_[current];
+                            }
+
+                            void
+                            abandon() noexcept
+                            {
+                                /* Does nothing if the stream is already over */
+                                if (started_) { ctx_.TryCancel(); }
+
+                                /* A message nobody will take is holding up the stream */
+                                if (signal_.exchange(kAbandoned, std::memory_order_acq_rel) ==
+                                        kReady &&
+                                    !ended_)
+                                {
+                                    op_ = kRead;
+                                    reader_->Read(&messages_[fill_], tag());
+                                }
+
+                                release();
+                            }
+
+                        private:
+
+                            void
+                            complete(bool _ok, const resumer& _resume) noexcept override
+                            {
+                                switch (op_)
+                                {
+                                    case kStart:
+                                        if (_ok)
+                                        {
+                                            op_ = kRead;
+                                            reader_->Read(&messages_[fill_], tag());
+                                            return;
+                                        }
+                                        [[fallthrough]];
+
+                                    case kRead:
+                                        if (!_ok)
+                                        {
+                                            op_ = kFinish;
+                                            reader_->Finish(&status_, tag());
+                                            return;
+                                        }
+
+                                        decide(grpc::StatusCode::OK);
+                                        break;
+
+                                    case kFinish:
+                                        endpoint_->in_flight_.fetch_sub(
+                                            1,
+                                            std::memory_order_relaxed);
+
+                                        /* It ended without a message */
+                                        decide(status_.error_code());
+
+                                        ended_ = true;
+                                        break;
+                                }
+
+                                /* Taken before signalling, after which the consumer may let go */
+                                const bool last = op_ == kFinish;
+
+                                auto signal = signal_.load(std::memory_order_acquire);
+                                do
+                                {
+                                    /* Nobody is reading, so drain the stream until it ends */
+                                    if (signal == kAbandoned)
+                                    {
+                                        if (last) { release(); }
+                                        else
+                                        {
+                                            reader_->Read(&messages_[fill_], tag());
+                                        }
+
+                                        return;
+                                    }
+
+                                } while (!signal_.compare_exchange_weak(
+                                    signal,
+                                    kReady,
+                                    std::memory_order_acq_rel,
+                                    std::memory_order_acquire));
+
+                                if (signal == kWaiting) { _resume(awaiter_); }
+
+                                if (last) { release(); }
+                            }
+
+                            /*
+                             * Streams only report to the breaker as its probe, and do so on their
+                             * first message rather than at the end, so a long stream does not
+                             * hold the circuit half open.
+                             *
+                             */
+                            inline void
+                            decide(int _code) noexcept
+                            {
+                                if (std::exchange(probe_, false))
+                                {
+                                    endpoint_->breaker_.record(true, _code, {}, true);
+                                }
+                            }
+
+                            void
+                            release() noexcept
+                            {
+                                if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                                {
+                                    /* The reader lives in the contexts arena so it must go first */
+                                    reader_.reset();
+                                    delete this;
+                                }
+                            }
+
+                            enum Op {
+                                kStart,
+                                kRead,
+                                kFinish
+                            };
+
+                            enum Signal {
+                                kIdle,
+                                kWaiting,
+                                kReady,
+                                kAbandoned
+                            };
+
+                            grpc_client* self_;
+
+                            stream_method<Request, Response> method_;
+
+                            const Request* request_;
+
+                            endpoint* endpoint_;
+
+                            grpc::ClientContext ctx_;
+
+                            std::unique_ptr<grpc::ClientAsyncReader<Response>> reader_;
+
+                            std::array<Response, 2> messages_;
+
+                            grpc::Status status_;
+
+                            void* awaiter_;
+
+                            Op op_;
+
+                            /* The message being read into */
+                            int fill_;
+
+                            bool started_;
+                            bool ended_;
+                            bool probe_;
+
+                            std::atomic<Signal> signal_;
+
+                            /* The owner and, while started, the completion queue */
+                            std::atomic<int> refs_;
+                    };
+
+                    state* state_;
+            };
+
+            template <typename... Args>
+            grpc_client(Args&&... _args)
+                : executer_(std::forward<Args>(_args)...),
+                  cq_(std::make_unique<grpc::CompletionQueue>()), queue_(cq_.get()),
+                  free_(nullptr), active_(0), next_(0),
+                  id_(ids().fetch_add(1, std::memory_order_relaxed))
+            { }
+
+            ~grpc_client()
+            {
+                stop();
+
+                /* Covers the case `run()` was never called */
+                cq_->Shutdown();
+
+                void* tag;
+                bool  ok;
+                while (cq_->Next(&tag, &ok)) { }
+
+                while (free_)
+                {
+                    delete std::exchange(free_, free_->next_);
+                }
+            }
+
+            template <typename Creds>
+            void
+            connect(std::string_view _address, Creds&& cred, pool_options _options = {})
+            {
+                connect_with_access(
+                    _address,
+                    std::forward<Creds>(cred),
+                    [](grpc::ChannelArguments&) {},
+                    _options);
+            }
+
+            template <typename Creds, typename Callback>
+            void
+            connect_with_access(
+                std::string_view _address,
+                Creds&&          cred,
+                Callback&&       _cb,
+                pool_options     _options = {})
+            {
+                const std::array<std::string_view, 1> addresses{_address};
+                connect_with_access(
+                    addresses,
+                    std::forward<Creds>(cred),
+                    std::forward<Callback>(_cb),
+                    _options);
+            }
+
+            /*
+             * Connect to several replicas of a service. Channel `i` is opened to address
+             * `i % size`, so at least one channel is opened to each of them. Throws
+             * `std::invalid_argument` if there are no addresses.
+             *
+             */
+            template <std::ranges::input_range Addresses, typename Creds>
+                requires std::convertible_to<std::ranges::range_reference_t<Addresses>,
+                                             std::string_view>
+            void
+            connect(const Addresses& _addresses, Creds&& cred, pool_options _options = {})
+            {
+                connect_with_access(
+                    _addresses,
+                    std::forward<Creds>(cred),
+                    [](grpc::ChannelArguments&) {},
+                    _options);
+            }
+
+            template <std::ranges::input_range Addresses, typename Creds, typename Callback>
+                requires std::convertible_to<std::ranges::range_reference_t<Addresses>,
+                                             std::string_view>
+            void
+            connect_with_access(
+                const Addresses& _addresses,
+                Creds&&          cred,
+                Callback&&       _cb,
+                pool_options     _options = {})
+            {
+                for (std::string_view address : _addresses)
+                {
+                    addresses_.emplace_back(address);
+                }
+
+                if (addresses_.empty())
+                {
+                    throw std::invalid_argument("co_grpc: connect needs at least one address");
+                }
+
+                _cb(args_);
+                args_.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+
+                creds_   = std::forward<Creds>(cred);
+                options_ = _options;
+
+                options_.channels =
+                    std::max({options_.channels, addresses_.size(), std::size_t{1}});
+                options_.max_channels = std::max(options_.channels, options_.max_channels);
+
+                endpoints_ = std::make_unique<endpoint[]>(options_.max_channels);
+                for (std::size_t i = 0; i < options_.channels; ++i)
+                {
+                    open(i);
+                }
+
+                active_.store(options_.channels, std::memory_order_release);
+            }
+
+            /*
+             * Issue calls on the completion queue of `_service` instead of our own. Completions
+             * are then drained by the service thread and resumed through its executer, so `run()`
+             * is not needed. The service must be built first.
+             *
+             * The destructor cannot drain the service's queue, so the client must outlive every
+             * call made through it, and the service must not stop before they have finished.
+             *
+             */
+            template <typename Service, typename E>
+            void
+            attach(grpc_service<Service, E>& _service) & noexcept
+            {
+                queue_ = &_service.completion_queue();
+            }
+
+            void
+            run() & noexcept
+            {
+                thread_ =
+                    std::jthread([this](std::stop_token _stop_token) { do_rpc(_stop_token); });
+            }
+
+            void
+            stop() & noexcept
+            {
+                thread_.request_stop();
+                if (thread_.joinable()) { thread_.join(); }
+            }
+
+            Stub&
+            stub() & noexcept
+            {
+                return *endpoints_[0].stub_;
+            }
+
+            grpc::Channel&
+            channel() & noexcept
+            {
+                return *endpoints_[0].channel_;
+            }
+
+            std::size_t
+            channels() const noexcept
+            {
+                return active_.load(std::memory_order_acquire);
+            }
+
+            std::size_t
+            in_flight() const noexcept
+            {
+                std::size_t total = 0;
+                for (std::size_t i = 0; i < channels(); ++i)
+                {
+                    total += endpoints_[i].in_flight_.load(std::memory_order_relaxed);
+                }
+
+                return total;
+            }
+
+            /*
+             * The queue calls complete on. This is the services queue if attached.
+             *
+             */
+            grpc::CompletionQueue&
+            completion_queue() & noexcept
+            {
+                return *queue_;
+            }
+
+            /*
+             * Start a unary call when awaited. `_method` should be the `AsyncXxx` member of the
+             * stub. The awaiter is resumed through the executer once the call is finished.
+             *
+             * `_request` is read when the call starts, so it must outlive the `co_await`.
+             *
+             */
+            template <typename Request, typename Response>
+            call_proxy<Request, Response>
+            call(
+                unary_method<Request, Response>      _method,
+                const std::type_identity_t<Request>& _request)
+            {
+                return call_proxy<Request, Response>(this, acquire(), _method, _request);
+            }
+
+            /*
+             * As above, but `_configure` is given the calls `grpc::ClientContext` before it is
+             * started. For example, to set a deadline or metadata.
+             *
+             */
+            template <typename Request, typename Response, typename Configure>
+            call_proxy<Request, Response>
+            call(
+                unary_method<Request, Response>      _method,
+                const std::type_identity_t<Request>& _request,
+                Configure&&                          _configure)
+            {
+                auto* c = acquire();
+                _configure(c->context());
+                return call_proxy<Request, Response>(this, c, _method, _request);
+            }
+
+            /*
+             * Start a unary call on behalf of an inbound rpc, for example with a request's
+             * `context()`. The context of the call is derived from `_parent` as `_options` allow,
+             * which by default passes on the deadline and cancels the call when the inbound rpc is
+             * cancelled. The call must start before the inbound rpc finishes.
+             *
+             */
+            template <typename Request, typename Response, typename Configure>
+            call_proxy<Request, Response>
+            call_from(
+                const grpc::ServerContext&           _parent,
+                unary_method<Request, Response>      _method,
+                const std::type_identity_t<Request>& _request,
+                Configure&&                          _configure,
+                const grpc::PropagationOptions&      _options)
+            {
+                auto* c = acquire(_parent, _options);
+                _configure(c->context());
+                return call_proxy<Request, Response>(this, c, _method, _request);
+            }
+
+            template <typename Request, typename Response, typename Configure>
+            call_proxy<Request, Response>
+            call_from(
+                const grpc::ServerContext&           _parent,
+                unary_method<Request, Response>      _method,
+                const std::type_identity_t<Request>& _request,
+                Configure&&                          _configure)
+            {
+                return call_from(
+                    _parent,
+                    _method,
+                    _request,
+                    std::forward<Configure>(_configure),
+                    grpc::PropagationOptions());
+            }
+
+            template <typename Request, typename Response>
+            call_proxy<Request, Response>
+            call_from(
+                const grpc::ServerContext&           _parent,
+                unary_method<Request, Response>      _method,
+                const std::type_identity_t<Request>& _request)
+            {
+                return call_from(_parent, _method, _request, [](grpc::ClientContext&) {});
+            }
+
+            /*
+             * Start a unary call that is hedged according to `_policy`. Both attempts are given
+             * to `_configure` before they start.
+             *
+             */
+            template <typename Request, typename Response, typename Configure>
+            hedge_proxy<Request, Response, std::decay_t<Configure>>
+            hedged(
+                hedge_policy&                        _policy,
+                unary_method<Request, Response>      _method,
+                const std::type_identity_t<Request>& _request,
+                Configure&&                          _configure)
+            {
+                return hedge_proxy<Request, Response, std::decay_t<Configure>>(
+                    this,
+                    _policy,
+                    _method,
+                    _request,
+                    std::forward<Configure>(_configure));
+            }
+
+            template <typename Request, typename Response>
+            auto
+            hedged(
+                hedge_policy&                        _policy,
+                unary_method<Request, Response>      _method,
+                const std::type_identity_t<Request>& _request)
+            {
+                return hedged(_policy, _method, _request, [](grpc::ClientContext&) {});
+            }
+
+            /*
+             * Start a unary call that is retried according to `_policy`. Every attempt is given
+             * to `_configure` before it starts.
+             *
+             */
+            template <typename Request, typename Response, typename Configure>
+            retry_proxy<Request, Response, std::decay_t<Configure>>
+            retried(
+                retry_policy&                        _policy,
+                unary_method<Request, Response>      _method,
+                const std::type_identity_t<Request>& _request,
+                Configure&&                          _configure)
+            {
+                return retry_proxy<Request, Response, std::decay_t<Configure>>(
+                    this,
+                    _policy,
+                    _method,
+                    _request,
+                    std::forward<Configure>(_configure));
+            }
+
+            template <typename Request, typename Response>
+            auto
+            retried(
+                retry_policy&                        _policy,
+                unary_method<Request, Response>      _method,
+                const std::type_identity_t<Request>& _request)
+            {
+                return retried(_policy, _method, _request, [](grpc::ClientContext&) {});
+            }
+
+            /*
+             * Read a server stream. `_method` should be the `PrepareAsyncXxx` member of the stub.
+             * `_request` is read when the stream starts, on the first `next()`.
+             *
+             */
+            template <typename Request, typename Response>
+            stream_reader<Request, Response>
+            stream(
+                stream_method<Request, Response>     _method,
+                const std::type_identity_t<Request>& _request)
+            {
+                return stream_reader<Request, Response>(this, _method, _request);
+            }
+
+            template <typename Request, typename Response, typename Configure>
+            stream_reader<Request, Response>
+            stream(
+                stream_method<Request, Response>     _method,
+                const std::type_identity_t<Request>& _request,
+                Configure&&                          _configure)
+            {
+                stream_reader<Request, Response> reader(this, _method, _request);
+                _configure(reader.context());
+                return reader;
+            }
+
+            /*
+             * Resumes with true once every open channel is connected, or with false if some are
+             * not by `_deadline`.
+             *
+             */
+            ready_proxy
+            ready(std::chrono::system_clock::time_point _deadline)
+            {
+                return ready_proxy(this, _deadline);
+            }
+
+            /*
+             * As above, but a channel is not ready until `_per_channel` calls of `_method` have
+             * been made on it. Resumes with false if any of them failed. The calls have
+             * `_deadline` as their deadline.
+             *
+             */
+            template <typename Request, typename Response>
+            warm_proxy<Request, Response>
+            ready(
+                std::chrono::system_clock::time_point _deadline,
+                unary_method<Request, Response>       _method,
+                const std::type_identity_t<Request>&  _request,
+                std::size_t                           _per_channel = 1)
+            {
+                return warm_proxy<Request, Response>(
+                    this,
+                    _deadline,
+                    _method,
+                    _request,
+                    _per_channel);
+            }
+
+        private:
+
+            void
+            do_rpc(std::stop_token _stop_token)
+            {
+                std::stop_callback callback(_stop_token, [this] { clean(); });
+
+                void* tag;
+                bool  ok;
+                if constexpr (batch_executer<Executer>)
+                {
+                    resume_batch<Executer>    batch(executer_);
+                    const completion::resumer resume(batch);
+
+                    /* A deadline in the past only polls */
+                    const std::chrono::system_clock::time_point poll;
+                    while (cq_->Next(&tag, &ok))
+                    {
+                        completion::from_tag(tag)->complete(ok, resume);
+
+                        /* Take what else is ready before handing over what it resumed */
+                        for (std::size_t i = 1; i < batch.capacity() &&
+                                                cq_->AsyncNext(&tag, &ok, poll) ==
+                                                    grpc::CompletionQueue::GOT_EVENT;
+                             ++i)
+                        {
+                            completion::from_tag(tag)->complete(ok, resume);
+                        }
+
+                        batch.flush();
+                    }
+                }
+                else
+                {
+                    const completion::resumer resume(executer_);
+                    while (cq_->Next(&tag, &ok))
+                    {
+                        completion::from_tag(tag)->complete(ok, resume);
+                    }
+                }
+            }
+
+            /* Called from `noexcept` starts, so nothing in here may throw */
+            endpoint*
+            pick(const endpoint* _avoid, bool& _probe) noexcept
+            {
+                const auto active = active_.load(std::memory_order_acquire);
+
+                std::size_t index;
+                if (options_.policy == pool_options::kLeastLoaded && active > 1)
+                {
+                    /* Power of two choices, between two distinct channels */
+                    static thread_local std::minstd_rand random(thread_seed());
+
+                    const std::size_t first  = random() % active;
+                    std::size_t       second = random() % (active - 1);
+                    if (second >= first) { ++second; }
+
+                    if (&endpoints_[first] == _avoid) { index = second; }
+                    else if (&endpoints_[second] == _avoid)
+                    {
+                        index = first;
+                    }
+                    else
+                    {
+                        index = endpoints_[second].cost() < endpoints_[first].cost() ? second
+                                                                                      : first;
+                    }
+                }
+                else if (options_.policy == pool_options::kPerThread)
+                {
+                    index = thread_index() % active;
+                }
+                else
+                {
+                    index = next_.fetch_add(1, std::memory_order_relaxed) % active;
+                }
+
+                if (&endpoints_[index] == _avoid) { index = (index + 1) % active; }
+
+                auto* chosen = &endpoints_[index];
+                if (active < options_.max_channels &&
+                    chosen->in_flight_.load(std::memory_order_relaxed) >=
+                        options_.streams_per_channel)
+                {
+                    grow(active);
+                }
+
+                _probe = false;
+                if (chosen->breaking_ && !chosen->breaker_.allow(_probe))
+                {
+                    /* Fall back to the next channel that is taking calls */
+                    chosen = nullptr;
+                    for (std::size_t i = 1; i < active && !chosen; ++i)
+                    {
+                        auto* other = &endpoints_[(index + i) % active];
+                        if (other != _avoid && other->breaker_.allow(_probe)) { chosen = other; }
+                    }
+                }
+
+                return chosen;
+            }
+
+            /*
+             * The channel index of the calling thread: its id hashed with `id_`, so a thread
+             * keeps its channel and each client spreads the threads differently. Nothing is
+             * stored, so a client made where another died starts afresh.
+             *
+             */
+            std::size_t
+            thread_index() const noexcept
+            {
+                static thread_local const std::uint64_t thread =
+                    std::hash<std::thread::id>{}(std::this_thread::get_id());
+
+                /* The finaliser of splitmix64, as thread ids hash to nearby values */
+                auto mixed = thread ^ (id_ * 0x9e3779b97f4a7c15ull);
+                mixed      = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ull;
+                mixed      = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebull;
+                return static_cast<std::size_t>(mixed ^ (mixed >> 31));
+            }
+
+            /* Each client is numbered, so the same thread lands differently on each */
+            static std::atomic<std::uint64_t>&
+            ids() noexcept
+            {
+                static std::atomic<std::uint64_t> counter{0};
+                return counter;
+            }
+
+            void
+            grow(std::size_t _active) noexcept
+            {
+                /* Someone else is already opening one */
+                std::unique_lock lck(grow_lock_, std::try_to_lock);
+                if (!lck || active_.load(std::memory_order_relaxed) != _active) { return; }
+
+                /* A channel that cannot be opened leaves the call on the one it picked */
+                try
+                {
+                    open(_active);
+                }
+                catch (...)
+                {
+                    return;
+                }
+
+                active_.store(_active + 1, std::memory_order_release);
+            }
+
+            void
+            open(std::size_t _index)
+            {
+                /* A distinct argument stops grpc from sharing a channel between them */
+                grpc::ChannelArguments args = args_;
+                args.SetInt("co_grpc.channel_index", static_cast<int>(_index));
+
+                auto& ep    = endpoints_[_index];
+                ep.channel_ = grpc::CreateCustomChannel(
+                    addresses_[_index % addresses_.size()],
+                    creds_,
+                    args);
+                ep.stub_    = std::make_unique<Stub>(ep.channel_);
+                ep.reports_ = options_.server_load;
+
+                /* Start connecting now rather than on the first call */
+                if (options_.preconnect) { ep.channel_->GetState(true); }
+
+                if (options_.breaker)
+                {
+                    ep.breaker_.configure(*options_.breaker);
+                    ep.breaking_ = true;
+                }
+            }
+
+            call_data*
+            acquire()
+            {
+                auto* c = take();
+                c->ctx_.emplace();
+                return c;
+            }
+
+            call_data*
+            acquire(const grpc::ServerContext& _parent, const grpc::PropagationOptions& _options)
+            {
+                auto* c     = take();
+                c->derived_ = grpc::ClientContext::FromServerContext(_parent, _options);
+                return c;
+            }
+
+            call_data*
+            take()
+            {
+                call_data* c = nullptr;
+                {
+                    std::lock_guard lck(pool_lock_);
+                    if (free_) { c = std::exchange(free_, free_->next_); }
+                }
+
+                if (!c) { c = new call_data(); }
+
+                c->parent_   = nullptr;
+                c->endpoint_ = nullptr;
+                c->ok_       = false;
+                c->probe_    = false;
+                return c;
+            }
+
+            void
+            release(call_data* _call) noexcept
+            {
+                _call->ctx_.reset();
+                _call->derived_.reset();
+
+                std::lock_guard lck(pool_lock_);
+                _call->next_ = free_;
+                free_        = _call;
+            }
+
+            void
+            clean()
+            {
+                cq_->Shutdown();
+            }
+
+            Executer executer_;
+
+            std::unique_ptr<grpc::CompletionQueue> cq_;
+
+            grpc::CompletionQueue* queue_;
+
+            std::mutex pool_lock_;
+            call_data* free_;
+
+            std::vector<std::string> addresses_;
+
+            std::shared_ptr<grpc::ChannelCredentials> creds_;
+
+            grpc::ChannelArguments args_;
+
+            pool_options options_;
+
+            std::mutex grow_lock_;
+
+            std::unique_ptr<endpoint[]> endpoints_;
+
+            std::atomic<std::size_t> active_;
+            std::atomic<std::size_t> next_;
+
+            /* Tells this client apart from any other made at the same address */
+            const std::uint64_t id_;
+
+            std::jthread thread_;
+    };
+
+    /*
+     * Awaits a range of calls that are started in one pass. The awaiter is resumed once with a
+     * reply for each call, in the order of the range.
+     *
+     */
+    template <typename Range>
+    class gather_proxy : public join {
+
+        public:
+
+            using response_type = typename std::ranges::range_value_t<Range>::response_type;
+
+            gather_proxy(
+                Range&                                _calls,
+                std::size_t                           _quorum,
+                std::chrono::system_clock::time_point _deadline)
+                : join(std::ranges::size(_calls), _quorum), calls_(_calls), deadline_(_deadline)
+            { }
+
+            bool
+            await_ready() const noexcept
+            {
+                return std::ranges::empty(calls_);
+            }
+
+            bool
+            await_suspend(std::coroutine_handle<> _awaiter) noexcept
+            {
+                awaiter_ = _awaiter.address();
+
+                for (auto& call : calls_)
+                {
+                    if (deadline_ != std::chrono::system_clock::time_point::max())
+                    {
+                        call.context().set_deadline(deadline_);
+                    }
+
+                    call.join_with(this);
+                    call.start();
+                }
+
+                return !issued();
+            }
+
+            std::vector<reply<response_type>>
+            await_resume()
+            {
+                std::vector<reply<response_type>> replies;
+                replies.reserve(std::ranges::size(calls_));
+
+                for (auto& call : calls_)
+                {
+                    replies.push_back(call.finish());
+                }
+
+                return replies;
+            }
+
+        private:
+
+            void
+            cancel() noexcept override
+            {
+                for (auto& call : calls_)
+                {
+                    call.context().TryCancel();
+                }
+            }
+
+            Range& calls_;
+
+            std::chrono::system_clock::time_point deadline_;
+    };
+
+    /*
+     * Awaits a fixed set of calls, possibly to different clients. The awaiter is resumed once
+     * with a tuple of their replies.
+     *
+     */
+    template <typename... Calls>
+    class all_proxy : public join {
+
+        public:
+
+            all_proxy(Calls&&... _calls)
+                : join(sizeof...(Calls), 0), calls_(std::move(_calls)...)
+            { }
+
+            bool
+            await_ready() const noexcept
+            {
+                return false;
+            }
+
+            bool
+            await_suspend(std::coroutine_handle<> _awaiter) noexcept
+            {
+                awaiter_ = _awaiter.address();
+
+                std::apply(
+                    [this](auto&... _call) { (start(_call), ...); },
+                    calls_);
+
+                return !issued();
+            }
+
+            std::tuple<reply<typename Calls::response_type>...>
+            await_resume()
+            {
+                return std::apply(
+                    [](auto&... _call) { return std::make_tuple(_call.finish()...); },
+                    calls_);
+            }
+
+        private:
+
+            template <typename Call>
+            void
+            start(Call& _call) noexcept
+            {
+                _call.join_with(this);
+                _call.start();
+            }
+
+            void
+            cancel() noexcept override
+            { }
+
+            std::tuple<Calls...> calls_;
+    };
+
+    template <typename Call>
+    concept outbound_call = requires { typename std::remove_cvref_t<Call>::response_type; };
+
+    /*
+     * Start all `_calls` and resume once they have all finished. Each call is given `_deadline`
+     * if it is set.
+     *
+     */
+    template <std::ranges::sized_range Range>
+    gather_proxy<Range>
+    when_all(
+        Range&                                _calls,
+        std::chrono::system_clock::time_point _deadline =
+            std::chrono::system_clock::time_point::max())
+    {
+        return gather_proxy<Range>(_calls, 0, _deadline);
+    }
+
+    template <outbound_call... Calls>
+    all_proxy<std::remove_cvref_t<Calls>...>
+    when_all(Calls&&... _calls)
+    {
+        return all_proxy<std::remove_cvref_t<Calls>...>(std::forward<Calls>(_calls)...);
+    }
+
+    /*
+     * Start all `_calls` and resume once `_quorum` have succeeded or it is no longer reachable.
+     * Calls still running at that point are cancelled.
+     *
+     */
+    template <std::ranges::sized_range Range>
+    gather_proxy<Range>
+    when_quorum(
+        Range&                                _calls,
+        std::size_t                           _quorum,
+        std::chrono::system_clock::time_point _deadline =
+            std::chrono::system_clock::time_point::max())
+    {
+        return gather_proxy<Range>(_calls, _quorum, _deadline);
+    }
+
+    template <std::ranges::sized_range Range>
+    gather_proxy<Range>
+    when_any(
+        Range&                                _calls,
+        std::chrono::system_clock::time_point _deadline =
+            std::chrono::system_clock::time_point::max())
+    {
+        return gather_proxy<Range>(_calls, 1, _deadline);
+    }
+
+    /*
+     * How long a `batcher` holds a batch open, and how large it may get.
+     *
+     */
+    struct batch_options {
+
+            std::size_t max_batch = 64;
+
+            std::chrono::microseconds window{100};
+    };
+
+    /*
+     * Collects single unary calls into a bulk rpc whose messages wrap the single messages in a
+     * repeated field. A batch is sent when it reaches `max_batch` calls or when `window` has passed
+     * since its first call, whichever comes first. The bulk reply is split back out to each
+     * awaiter.
+     *
+     * If the bulk rpc fails, every call in it gets its status. Batches are pooled and reused, so
+     * their repeated fields keep their capacity between sends.
+     *
+     * The batcher must outlive every call made through it.
+     *
+     */
+    template <
+        typename Client,
+        typename Request,
+        typename Response,
+        typename BatchRequest,
+        typename BatchResponse>
+    class batcher {
+
+        public:
+
+            using batch_method = typename Client::template unary_method<BatchRequest, BatchResponse>;
+
+            /* For example `&HelloBatch::add_items` */
+            using add_method = Request* (BatchRequest::*)();
+
+            /* For example `&GoodbyeBatch::items` and `&GoodbyeBatch::items_size` */
+            using get_method  = const Response& (BatchResponse::*)(int) const;
+            using size_method = int (BatchResponse::*)() const;
+
+            class call_proxy {
+
+                    friend class batcher;
+
+                public:
+
+                    call_proxy(batcher* _self, const Request& _request)
+                        : self_(_self), request_(&_request), awaiter_(nullptr)
+                    { }
+
+                    bool
+                    await_ready() const noexcept
+                    {
+                        return false;
+                    }
+
+                    void
+                    await_suspend(std::coroutine_handle<> _awaiter) noexcept
+                    {
+                        awaiter_ = _awaiter.address();
+                        self_->add(this);
+                    }
+
+                    reply<Response>
+                    await_resume() noexcept
+                    {
+                        return std::move(reply_);
+                    }
+
+                private:
+
+                    batcher* self_;
+
+                    const Request* request_;
+
+                    void* awaiter_;
+
+                    reply<Response> reply_;
+            };
+
+            batcher(
+                Client&       _client,
+                batch_method  _method,
+                add_method    _add,
+                get_method    _get,
+                size_method   _size,
+                batch_options _options = {})
+                : client_(_client), method_(_method), add_(_add), get_(_get), size_(_size),
+                  options_(_options), open_(nullptr), free_(nullptr)
+            { }
+
+            batcher(const batcher&) = delete;
+
+            ~batcher()
+            {
+                while (free_)
+                {
+                    delete std::exchange(free_, free_->next_);
+                }
+            }
+
+            call_proxy
+            call(const Request& _request)
+            {
+                return call_proxy(this, _request);
+            }
+
+        private:
+
+            class batch : public completion {
+
+                    friend class batcher;
+
+                public:
+
+                    batch(batcher* _self) : self_(_self), timer_(this), next_(nullptr), pending_(0)
+                    { }
+
+                private:
+
+                    /* The bulk rpc finished */
+                    void
+                    complete(bool _success, const resumer& _resume) noexcept override
+                    {
+                        auto result = call_->finish();
+                        call_.reset();
+
+                        const auto size = (result.message.*self_->size_)();
+                        for (std::size_t i = 0; i < waiters_.size(); ++i)
+                        {
+                            auto& reply = waiters_[i]->reply_;
+                            if (!_success) { reply.status = result.status; }
+                            else if (i < static_cast<std::size_t>(size))
+                            {
+                                reply.message = (result.message.*self_->get_)(static_cast<int>(i));
+                            }
+                            else
+                            {
+                                reply.status = grpc::Status(
+                                    grpc::StatusCode::INTERNAL,
+                                    "Batch reply is missing items");
+                            }
+                        }
+
+                        for (auto* waiter : waiters_)
+                        {
+                            _resume(waiter->awaiter_);
+                        }
+
+                        self_->done(this);
+                    }
+
+                    /* The window passed, or the alarm was cancelled */
+                    struct timer : public completion {
+
+                            timer(batch* _batch) : batch_(_batch) { }
+
+                            void
+                            complete(bool _ok, const resumer&) noexcept override
+                            {
+                                if (_ok) { batch_->self_->expire(batch_); }
+
+                                batch_->self_->done(batch_);
+                            }
+
+                            batch* batch_;
+                    };
+
+                    batcher* self_;
+
+                    timer timer_;
+
+                    grpc::Alarm alarm_;
+
+                    BatchRequest request_;
+
+                    std::vector<call_proxy*> waiters_;
+
+                    std::optional<typename Client::template call_proxy<BatchRequest, BatchResponse>>
+                        call_;
+
+                    batch* next_;
+
+                    /* The alarm and the rpc */
+                    std::atomic<std::size_t> pending_;
+            };
+
+            void
+            add(call_proxy* _call)
+            {
+                batch* full = nullptr;
+                {
+                    std::lock_guard lck(lock_);
+                    if (!open_)
+                    {
+                        open_ = acquire();
+                        open_->alarm_.Set(
+                            &client_.completion_queue(),
+                            std::chrono::system_clock::now() + options_.window,
+                            open_->timer_.tag());
+                    }
+
+                    *(open_->request_.*add_)() = *_call->request_;
+                    open_->waiters_.push_back(_call);
+
+                    if (open_->waiters_.size() >= options_.max_batch)
+                    {
+                        full = std::exchange(open_, nullptr);
+                    }
+                }
+
+                if (full)
+                {
+                    full->alarm_.Cancel();
+                    send(full);
+                }
+            }
+
+            void
+            expire(batch* _batch)
+            {
+                {
+                    std::lock_guard lck(lock_);
+                    if (open_ != _batch) { return; }
+
+                    open_ = nullptr;
+                }
+
+                send(_batch);
+            }
+
+            void
+            send(batch* _batch)
+            {
+                _batch->call_.emplace(client_.call(method_, _batch->request_));
+                _batch->call_->join_with(_batch);
+
+                /* May complete before returning */
+                _batch->call_->start();
+            }
+
+            batch*
+            acquire()
+            {
+                batch* b = free_;
+                if (b) { free_ = b->next_; }
+                else
+                {
+                    b = new batch(this);
+                }
+
+                b->pending_.store(2, std::memory_order_relaxed);
+                return b;
+            }
+
+            void
+            done(batch* _batch)
+            {
+                if (_batch->pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    _batch->request_.Clear();
+                    _batch->waiters_.clear();
+
+                    std::lock_guard lck(lock_);
+                    _batch->next_ = free_;
+                    free_         = _batch;
+                }
+            }
+
+            Client& client_;
+
+            batch_method method_;
+            add_method   add_;
+            get_method   get_;
+            size_method  size_;
+
+            batch_options options_;
+
+            std::mutex lock_;
+            batch*     open_;
+            batch*     free_;
+    };
+
+    struct cache_options {
+
+            /* How long a reply is served without asking again */
+            std::chrono::microseconds ttl{1000000};
+
+            /* How long past `ttl` a reply is still served while it is refreshed */
+            std::chrono::microseconds stale{0};
+
+            /* The deadline of each outbound call, none if zero */
+            std::chrono::microseconds timeout{0};
+
+            /* Split over the shards of the cache, each dropping its least recently used reply */
+            std::size_t max_entries = 10000;
+    };
+
+    /*
+     * Counters of a `response_cache`.
+     *
+     */
+    struct cache_stats {
+
+            std::uint64_t hits;
+
+            /* Hits on a reply past its ttl, which started or joined a refresh */
+            std::uint64_t stale;
+
+            std::uint64_t misses;
+
+            /* Misses that waited on a call another miss had already made */
+            std::uint64_t coalesced;
+    };
+
+    /*
+     * Caches the replies of one unary method, keyed by the serialized request.
+     *
+     * A reply younger than `ttl` is returned without a call. One younger than `ttl + stale` is
+     * still returned, but the first caller to see it starts a refresh in the background.
+     * Concurrent misses on the same request wait on a single outbound call. Failed replies are
+     * passed to the callers waiting on them but are not cached, so a stale reply is kept until it
+     * expires.
+     *
+     * The replies are spread over shards by the hash of their key, each with its own lock and
+     * its own order of use, so a hit only locks one shard and a full shard evicts in O(1).
+     *
+     * Requests are serialized with `SerializeToString`, so messages with map fields may not
+     * always hit. The cache must outlive every call made through it.
+     *
+     */
+    template <typename Client, typename Request, typename Response>
+    class response_cache {
+
+        public:
+
+            using method = typename Client::template unary_method<Request, Response>;
+
+            class call_proxy {
+
+                    friend class response_cache;
+
+                public:
+
+                    call_proxy(response_cache* _self, const Request& _request)
+                        : self_(_self), request_(&_request), awaiter_(nullptr)
+                    { }
+
+                    bool
+                    await_ready() const noexcept
+                    {
+                        return false;
+                    }
+
+                    /* Does not suspend on a hit */
+                    bool
+                    await_suspend(std::coroutine_handle<> _awaiter) noexcept
+                    {
+                        awaiter_ = _awaiter.address();
+                        return self_->lookup(this);
+                    }
+
+                    reply<Response>
+                    await_resume() noexcept
+                    {
+                        return std::move(reply_);
+                    }
+
+                private:
+
+                    response_cache* self_;
+
+                    const Request* request_;
+
+                    void* awaiter_;
+
+                    reply<Response> reply_;
+            };
+
+            response_cache(Client& _client, method _method, cache_options _options = {})
+                : client_(_client), method_(_method), options_(_options),
+                  capacity_(
+                      std::max<std::size_t>((_options.max_entries + kShards - 1) / kShards, 1))
+            { }
+
+            response_cache(const response_cache&) = delete;
+
+            call_proxy
+            call(const Request& _request)
+            {
+                return call_proxy(this, _request);
+            }
+
+            /* Drop every reply that is not being fetched */
+            void
+            clear()
+            {
+                for (auto& part : shards_)
+                {
+                    std::lock_guard lck(part.lock_);
+
+                    auto* e = part.head_;
+                    while (e)
+                    {
+                        auto* next = e->lru_next_;
+                        if (!e->fetching_) { part.erase(e); }
+
+                        e = next;
+                    }
+                }
+            }
+
+            cache_stats
+            stats() const noexcept
+            {
+                cache_stats total{0, 0, 0, 0};
+                for (const auto& part : shards_)
+                {
+                    total.hits += part.hits_.load(std::memory_order_relaxed);
+                    total.stale += part.stale_.load(std::memory_order_relaxed);
+                    total.misses += part.misses_.load(std::memory_order_relaxed);
+                    total.coalesced += part.coalesced_.load(std::memory_order_relaxed);
+                }
+
+                return total;
+            }
+
+        private:
+
+            using clock = std::chrono::steady_clock;
+
+            class shard;
+
+            /*
+             * A cached reply and the call that fetches it. Only removed from the cache while no
+             * call is in flight.
+             *
+             */
+            class entry : public completion {
+
+                    friend class response_cache;
+
+                public:
+
+                    entry(
+                        response_cache*  _self,
+                        shard*           _shard,
+                        std::string_view _key,
+                        const Request&   _request)
+                        : self_(_self), shard_(_shard), key_(_key), request_(_request),
+                          lru_prev_(nullptr), lru_next_(nullptr), valid_(false), fetching_(false)
+                    { }
+
+                private:
+
+                    void
+                    complete(bool _success, const resumer& _resume) noexcept override
+                    {
+                        auto result = call_->finish();
+                        call_.reset();
+
+                        std::vector<call_proxy*> waiters;
+                        {
+                            std::lock_guard lck(shard_->lock_);
+                            if (_success)
+                            {
+                                reply_   = result;
+                                fetched_ = clock::now();
+                                valid_   = true;
+                            }
+
+                            fetching_ = false;
+                            waiters.swap(waiters_);
+                        }
+
+                        for (auto* waiter : waiters)
+                        {
+                            waiter->reply_ = result;
+                            _resume(waiter->awaiter_);
+                        }
+                    }
+
+                    /* Only called by the caller that set `fetching_` */
+                    void
+                    fetch()
+                    {
+                        call_.emplace(self_->client_.call(self_->method_, request_));
+                        if (self_->options_.timeout.count())
+                        {
+                            call_->context().set_deadline(
+                                std::chrono::system_clock::now() + self_->options_.timeout);
+                        }
+
+                        call_->join_with(this);
+
+                        /* May complete before returning */
+                        call_->start();
+                    }
+
+                    response_cache* self_;
+
+                    shard* shard_;
+
+                    /* The serialized request, which the shard's map is keyed on */
+                    const std::string key_;
+
+                    const Request request_;
+
+                    std::optional<typename Client::template call_proxy<Request, Response>> call_;
+
+                    reply<Response> reply_;
+
+                    clock::time_point fetched_;
+
+                    std::vector<call_proxy*> waiters_;
+
+                    /* Links of the shard's recency list */
+                    entry* lru_prev_;
+                    entry* lru_next_;
+
+                    bool valid_;
+                    bool fetching_;
+            };
+
+            /*
+             * A part of the cache with its own lock, so callers on different keys rarely wait
+             * on each other. Its entries are kept in order of use, most recent first, so the
+             * one to evict is found at the tail.
+             *
+             */
+            class alignas(64) shard {
+
+                    friend class response_cache;
+
+                public:
+
+                    shard() : head_(nullptr), tail_(nullptr), hits_(0), stale_(0), misses_(0),
+                              coalesced_(0)
+                    { }
+
+                private:
+
+                    void
+                    push_front(entry* _entry) noexcept
+                    {
+                        _entry->lru_prev_ = nullptr;
+                        _entry->lru_next_ = head_;
+                        if (head_) { head_->lru_prev_ = _entry; }
+                        else
+                        {
+                            tail_ = _entry;
+                        }
+
+                        head_ = _entry;
+                    }
+
+                    void
+                    unlink(entry* _entry) noexcept
+                    {
+                        if (_entry->lru_prev_) { _entry->lru_prev_->lru_next_ = _entry->lru_next_; }
+                        else
+                        {
+                            head_ = _entry->lru_next_;
+                        }
+
+                        if (_entry->lru_next_) { _entry->lru_next_->lru_prev_ = _entry->lru_prev_; }
+                        else
+                        {
+                            tail_ = _entry->lru_prev_;
+                        }
+                    }
+
+                    /* Frees `_entry` */
+                    void
+                    erase(entry* _entry)
+                    {
+                        unlink(_entry);
+                        entries_.erase(std::string_view(_entry->key_));
+                    }
+
+                    /* Only written under the lock, but read by `stats` without it */
+                    static inline void
+                    bump(std::atomic<std::uint64_t>& _counter) noexcept
+                    {
+                        _counter.store(
+                            _counter.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_relaxed);
+                    }
+
+                    std::mutex lock_;
+
+                    std::unordered_map<std::string_view, std::unique_ptr<entry>> entries_;
+
+                    entry* head_;
+                    entry* tail_;
+
+                    std::atomic<std::uint64_t> hits_;
+                    std::atomic<std::uint64_t> stale_;
+                    std::atomic<std::uint64_t> misses_;
+                    std::atomic<std::uint64_t> coalesced_;
+            };
+
+            /* True if `_call` has to wait for the reply */
+            bool
+            lookup(call_proxy* _call)
+            {
+                /* Reuses its capacity, so a lookup does not allocate its key */
+                static thread_local std::string key;
+                _call->request_->SerializeToString(&key);
+
+                const std::string_view view(key);
+                auto& part = shards_[std::hash<std::string_view>{}(view) % kShards];
+
+                entry* fetch = nullptr;
+                bool   wait  = false;
+                {
+                    std::lock_guard lck(part.lock_);
+
+                    entry* e  = nullptr;
+                    auto   it = part.entries_.find(view);
+                    if (it == part.entries_.end())
+                    {
+                        if (part.entries_.size() >= capacity_) { evict(part); }
+
+                        auto made = std::make_unique<entry>(this, &part, view, *_call->request_);
+                        e         = made.get();
+                        part.entries_.emplace(std::string_view(e->key_), std::move(made));
+                    }
+                    else
+                    {
+                        e = it->second.get();
+                        part.unlink(e);
+                    }
+
+                    part.push_front(e);
+
+                    const auto age = clock::now() - e->fetched_;
+                    if (e->valid_ && age < options_.ttl)
+                    {
+                        shard::bump(part.hits_);
+                        _call->reply_ = e->reply_;
+                    }
+                    else if (e->valid_ && age < options_.ttl + options_.stale)
+                    {
+                        shard::bump(part.stale_);
+                        _call->reply_ = e->reply_;
+
+                        if (!e->fetching_) { fetch = e; }
+                    }
+                    else
+                    {
+                        if (e->fetching_) { shard::bump(part.coalesced_); }
+                        else
+                        {
+                            shard::bump(part.misses_);
+                            fetch = e;
+                        }
+
+                        e->waiters_.push_back(_call);
+                        wait = true;
+                    }
+
+                    if (fetch) { fetch->fetching_ = true; }
+                }
+
+                /* `_call` may be resumed before this returns */
+                if (fetch) { fetch->fetch(); }
+
+                return wait;
+            }
+
+            /*
+             * Drop the least recently used reply that is not being fetched. Fetches are few and
+             * move their entry to the front, so this rarely looks past the tail.
+             *
+             */
+            void
+            evict(shard& _part)
+            {
+                for (auto* e = _part.tail_; e; e = e->lru_prev_)
+                {
+                    if (!e->fetching_)
+                    {
+                        _part.erase(e);
+                        return;
+                    }
+                }
+            }
+
+            static constexpr std::size_t kShards = 16;
+
+            Client& client_;
+
+            method method_;
+
+            cache_options options_;
+
+            /* The most entries of each shard */
+            std::size_t capacity_;
+
+            std::array<shard, kShards> shards_;
+    };
+}   // namespace co_grpc
+
+#endif /* CO_GRPC_CLIENT_HPP_ */
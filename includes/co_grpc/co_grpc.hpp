@@ -31,276 +31,2181 @@
 #ifndef CO_GRCP_HPP_
 #define CO_GRCP_HPP_
 
+#include <algorithm>
 #include <atomic>
+#include <charconv>
+#include <chrono>
 #include <condition_variable>
 #include <coroutine>
+#include <cstdint>
 #include <deque>
+#include <exception>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <span>
+#include <string>
 #include <string_view>
 #include <thread>
 #include <type_traits>
 #include <utility>
+#include <vector>
+
+#include <grpcpp/alarm.h>
+
+#include "spin.hpp"
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
 
 namespace grpc {
     class Server;
     class ServerCompletionQueue;
     class ServerBuilder;
     class ServerContext;
+    class Status;
 }   // namespace grpc
 
 namespace co_grpc {
 
-    template <typename Service, typename Executer>
-    class grpc_service {
+    /*
+     * The trailing metadata key a server reports its load under. The value is the number of
+     * requests in flight, the number queued for a consumer and the recent queue delay in
+     * microseconds, as comma separated integers.
+     *
+     */
+    inline constexpr std::string_view kLoadReportKey = "co-grpc-load";
+
+    /*
+     * A completion queue tag that is not a `request`.
+     *
+     * These are placed on a completion queue with their low bit set so a drain loop can tell them
+     * apart from requests. `complete` is run on the draining thread and hands any coroutines it
+     * made ready to `_resume`, which passes them on to the executer of that thread.
+     *
+     */
+    class completion {
 
         public:
 
-            class request {
+            class resumer {
 
-                    friend class grpc_service;
+                public:
+
+                    template <typename Executer>
+                    explicit resumer(Executer& _executer) noexcept
+                        : executer_(&_executer), execute_([](void* _erased, void* _awaiter) {
+                              static_cast<Executer*>(_erased)->execute(_awaiter);
+                          })
+                    { }
+
+                    inline void
+                    operator()(void* _awaiter) const
+                    {
+                        execute_(executer_, _awaiter);
+                    }
+
+                private:
+
+                    void* executer_;
+
+                    void (*execute_)(void*, void*);
+            };
+
+            virtual ~completion() = default;
+
+            virtual void
+            complete(bool _ok, const resumer& _resume) noexcept = 0;
+
+            inline void*
+            tag() noexcept
+            {
+                return reinterpret_cast<void*>(reinterpret_cast<std::uintptr_t>(this) | kTagFlag);
+            }
+
+            static inline completion*
+            from_tag(void* _tag) noexcept
+            {
+                const auto address = reinterpret_cast<std::uintptr_t>(_tag);
+
+                if (address & kTagFlag)
+                {
+                    return reinterpret_cast<completion*>(address & ~kTagFlag);
+                }
+                else
+                {
+                    return nullptr;
+                }
+            }
+
+        private:
+
+            static constexpr std::uintptr_t kTagFlag = 0b1;
+    };
+
+    /* An `Executer` that can also be handed several coroutines to resume at once */
+    template <typename Executer>
+    concept batch_executer = requires(Executer& _executer, std::span<void*> _awaiters) {
+        _executer.execute_batch(_awaiters);
+    };
+
+    /*
+     * Collects the coroutines made ready while draining a completion queue so they are handed
+     * to `execute_batch` together, at most `capacity()` at a time.
+     *
+     */
+    template <typename Executer>
+    class resume_batch {
+
+        public:
+
+            explicit resume_batch(Executer& _executer) noexcept : executer_(_executer), size_(0)
+            { }
+
+            inline void
+            execute(void* _awaiter)
+            {
+                if (size_ == kCapacity) { flush(); }
+
+                awaiters_[size_++] = _awaiter;
+            }
+
+            inline void
+            flush()
+            {
+                if (size_)
+                {
+                    executer_.execute_batch(std::span<void*>(awaiters_, size_));
+                    size_ = 0;
+                }
+            }
+
+            static constexpr std::size_t
+            capacity() noexcept
+            {
+                return kCapacity;
+            }
+
+        private:
+
+            static constexpr std::size_t kCapacity = 64;
+
+            Executer& executer_;
+
+            std::size_t size_;
+
+            void* awaiters_[kCapacity];
+    };
+
+    /*
+     * A synchronous generator of messages that ends with a status.
+     *
+     * The body `co_yield`s messages and finishes with `co_return status;`. Each `next()` runs it
+     * up to its next message, which stays valid until the following `next()`.
+     *
+     */
+    template <typename Message>
+    class generator {
+
+        public:
+
+            struct promise_type {
+
+                    generator
+                    get_return_object() noexcept
+                    {
+                        return generator(std::coroutine_handle<promise_type>::from_promise(*this));
+                    }
+
+                    std::suspend_always
+                    initial_suspend() const noexcept
+                    {
+                        return {};
+                    }
+
+                    std::suspend_always
+                    final_suspend() const noexcept
+                    {
+                        return {};
+                    }
+
+                    std::suspend_always
+                    yield_value(Message& _message) noexcept
+                    {
+                        message_ = &_message;
+                        return {};
+                    }
+
+                    /* The temporary lives until the body is resumed */
+                    std::suspend_always
+                    yield_value(Message&& _message) noexcept
+                    {
+                        message_ = &_message;
+                        return {};
+                    }
+
+                    void
+                    return_value(grpc::Status _status) noexcept
+                    {
+                        status_ = std::move(_status);
+                    }
+
+                    void
+                    unhandled_exception() const noexcept
+                    {
+                        std::terminate();
+                    }
+
+                    Message* message_ = nullptr;
+
+                    grpc::Status status_;
+            };
+
+            generator() noexcept : handle_(nullptr) { }
+
+            generator(const generator&) = delete;
+
+            generator(generator&& _move) noexcept : handle_(std::exchange(_move.handle_, nullptr))
+            { }
+
+            generator&
+            operator=(generator&& _move) noexcept
+            {
+                if (handle_) { handle_.destroy(); }
+
+                handle_ = std::exchange(_move.handle_, nullptr);
+                return *this;
+            }
+
+            ~generator()
+            {
+                if (handle_) { handle_.destroy(); }
+            }
+
+            /* The next message, or nullptr once the body has returned, however often it is asked */
+            Message*
+            next() noexcept
+            {
+                /* Resuming a finished coroutine is undefined */
+                if (!handle_ || handle_.done()) { return nullptr; }
+
+                handle_.resume();
+                return handle_.done() ? nullptr : handle_.promise().message_;
+            }
+
+            /* What the body returned */
+            const grpc::Status&
+            status() const noexcept
+            {
+                return handle_.promise().status_;
+            }
+
+        private:
+
+            explicit generator(std::coroutine_handle<promise_type> _handle) noexcept
+                : handle_(_handle)
+            { }
+
+            std::coroutine_handle<promise_type> handle_;
+    };
+
+    /*
+     * A coroutine that is started by a request and tells it when it has returned.
+     *
+     * It does not run until `start`, and calls `_done` with `_context` once its body has
+     * returned. `_done` may destroy the task.
+     *
+     */
+    template <typename Result>
+    class task {
+
+        public:
+
+            struct promise_type {
+
+                    struct final_awaiter {
+
+                            bool
+                            await_ready() const noexcept
+                            {
+                                return false;
+                            }
+
+                            void
+                            await_suspend(std::coroutine_handle<promise_type> _handle) noexcept
+                            {
+                                auto& promise = _handle.promise();
+
+                                /* The frame may be gone once this returns */
+                                promise.done_(promise.context_);
+                            }
+
+                            void
+                            await_resume() const noexcept
+                            { }
+                    };
+
+                    task
+                    get_return_object() noexcept
+                    {
+                        return task(std::coroutine_handle<promise_type>::from_promise(*this));
+                    }
+
+                    std::suspend_always
+                    initial_suspend() const noexcept
+                    {
+                        return {};
+                    }
+
+                    final_awaiter
+                    final_suspend() const noexcept
+                    {
+                        return {};
+                    }
+
+                    void
+                    return_value(Result _result) noexcept
+                    {
+                        result_.emplace(std::move(_result));
+                    }
+
+                    void
+                    unhandled_exception() const noexcept
+                    {
+                        std::terminate();
+                    }
+
+                    std::optional<Result> result_;
+
+                    void (*done_)(void*) = nullptr;
+                    void* context_       = nullptr;
+            };
+
+            task() noexcept : handle_(nullptr) { }
+
+            task(const task&) = delete;
+
+            task(task&& _move) noexcept : handle_(std::exchange(_move.handle_, nullptr)) { }
+
+            task&
+            operator=(task&& _move) noexcept
+            {
+                if (handle_) { handle_.destroy(); }
+
+                handle_ = std::exchange(_move.handle_, nullptr);
+                return *this;
+            }
+
+            ~task()
+            {
+                if (handle_) { handle_.destroy(); }
+            }
+
+            void
+            start(void (*_done)(void*), void* _context) noexcept
+            {
+                handle_.promise().done_    = _done;
+                handle_.promise().context_ = _context;
+                handle_.resume();
+            }
+
+            /* Only valid once it has returned */
+            Result&
+            result() noexcept
+            {
+                return *handle_.promise().result_;
+            }
+
+        private:
+
+            explicit task(std::coroutine_handle<promise_type> _handle) noexcept : handle_(_handle)
+            { }
+
+            std::coroutine_handle<promise_type> handle_;
+    };
+
+    /*
+     * Reads the messages of a client stream in batches for a `client_stream_request`.
+     *
+     * Reads are chained on the thread draining the completion queue, so a message costs no trip
+     * through the request queue. The messages are read into two buffers in turn: while a handler
+     * works on one batch the next is read into the other buffer, and reading pauses when both
+     * are full. Messages are reused, so a batch is only valid until the next `read_batch`.
+     *
+     * A handler can return before the stream is over, so the owner and each read in flight hold
+     * a reference. The owner lets go with `close` and is freed once the last read has drained.
+     *
+     */
+    template <typename Request>
+    class batch_reader : public completion {
+
+        public:
+
+            class batch_proxy {
 
                 public:
 
-                    request(grpc_service& _service)
-                        : service_(_service), next_(nullptr), state_(kNew)
-                    { }
+                    batch_proxy(batch_reader* _self, std::size_t _size) noexcept
+                        : self_(_self), size_(_size)
+                    { }
+
+                    bool
+                    await_ready() const noexcept
+                    {
+                        return self_->ready(size_);
+                    }
+
+                    bool
+                    await_suspend(std::coroutine_handle<> _awaiter) noexcept
+                    {
+                        return self_->wait(_awaiter.address());
+                    }
+
+                    /* Empty once the stream is over */
+                    std::span<Request>
+                    await_resume() const noexcept
+                    {
+                        return self_->batch();
+                    }
+
+                private:
+
+                    batch_reader* self_;
+
+                    std::size_t size_;
+            };
+
+            template <typename Stream>
+            batch_reader(Stream* _stream, std::size_t _max_batch)
+                : stream_(_stream), read_([](void* _erased, Request* _message, void* _tag) {
+                      static_cast<Stream*>(_erased)->Read(_message, _tag);
+                  }),
+                  awaiter_(nullptr), want_(1), fill_(0), filled_(0), current_(0), count_(0),
+                  started_(false), ended_(false), finished_(false), signal_(kIdle), closed_(false),
+                  refs_(1), free_(nullptr), on_read_(nullptr), owner_(nullptr)
+            {
+                const auto size = std::max<std::size_t>(_max_batch, 1);
+                buffers_[0].resize(size);
+                buffers_[1].resize(size);
+            }
+
+            batch_reader(const batch_reader&) = delete;
+
+            /* Resumes with up to `_size` messages, fewer only at the end of the stream */
+            batch_proxy
+            read_batch(std::size_t _size) noexcept
+            {
+                return batch_proxy(this, _size);
+            }
+
+            /* `_read(_owner)` is called on the completion queue thread as each message arrives */
+            void
+            watch(void (*_read)(void*), void* _owner) noexcept
+            {
+                on_read_ = _read;
+                owner_   = _owner;
+            }
+
+            /* Called by the owner when it is done, `_free(_owner)` once no read is in flight */
+            void
+            close(void (*_free)(void*), void* _owner) noexcept
+            {
+                free_  = _free;
+                owner_ = _owner;
+                closed_.store(true, std::memory_order_release);
+
+                release();
+            }
+
+        private:
+
+            /* The read of `buffers_[fill_][filled_]` finished */
+            void
+            complete(bool _ok, const resumer& _resume) noexcept override
+            {
+                if (!closed_.load(std::memory_order_acquire)) { advance(_ok, _resume); }
+
+                /* This may free the owner, so it must be last */
+                release();
+            }
+
+            void
+            advance(bool _ok, const resumer& _resume) noexcept
+            {
+                if (_ok && on_read_) { on_read_(owner_); }
+
+                if (_ok && ++filled_ < want_.load(std::memory_order_relaxed))
+                {
+                    read();
+                    return;
+                }
+
+                if (!_ok) { ended_ = true; }
+
+                /* Park the batch until it is asked for */
+                auto idle = kIdle;
+                if (signal_.compare_exchange_strong(
+                        idle,
+                        kReady,
+                        std::memory_order_acq_rel,
+                        std::memory_order_acquire))
+                {
+                    return;
+                }
+
+                /* The handler is waiting for it */
+                hand_over();
+                _resume(awaiter_);
+            }
+
+            void
+            release() noexcept
+            {
+                if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) { free_(owner_); }
+            }
+
+            /* Only the handler calls these */
+            bool
+            ready(std::size_t _size) noexcept
+            {
+                want_.store(
+                    std::clamp<std::size_t>(_size, 1, buffers_[0].size()),
+                    std::memory_order_relaxed);
+
+                if (finished_)
+                {
+                    count_ = 0;
+                    return true;
+                }
+
+                if (!std::exchange(started_, true))
+                {
+                    read();
+                    return false;
+                }
+
+                if (signal_.load(std::memory_order_acquire) == kReady)
+                {
+                    hand_over();
+                    return true;
+                }
+
+                return false;
+            }
+
+            /* False if the batch was parked first */
+            bool
+            wait(void* _awaiter) noexcept
+            {
+                awaiter_ = _awaiter;
+
+                auto idle = kIdle;
+                if (signal_.compare_exchange_strong(
+                        idle,
+                        kWaiting,
+                        std::memory_order_acq_rel,
+                        std::memory_order_acquire))
+                {
+                    return true;
+                }
+
+                hand_over();
+                return false;
+            }
+
+            std::span<Request>
+            batch() noexcept
+            {
+                return std::span<Request>(buffers_[current_].data(), count_);
+            }
+
+            /* Give the filled buffer to the handler and read on into the other */
+            void
+            hand_over() noexcept
+            {
+                current_ = fill_;
+                count_   = filled_;
+                fill_ ^= 1;
+                filled_ = 0;
+
+                if (ended_) { finished_ = true; }
+
+                signal_.store(kIdle, std::memory_order_release);
+                if (!ended_) { read(); }
+            }
+
+            inline void
+            read() noexcept
+            {
+                refs_.fetch_add(1, std::memory_order_relaxed);
+                read_(stream_, &buffers_[fill_][filled_], tag());
+            }
+
+            enum Signal {
+                kIdle,
+                kWaiting,
+                kReady
+            };
+
+            void* stream_;
+
+            void (*read_)(void*, Request*, void*);
+
+            std::vector<Request> buffers_[2];
+
+            void* awaiter_;
+
+            std::atomic<std::size_t> want_;
+
+            /* The buffer being read into and how much of it is */
+            int         fill_;
+            std::size_t filled_;
+
+            /* The buffer the handler has */
+            int         current_;
+            std::size_t count_;
+
+            bool started_;
+            bool ended_;
+            bool finished_;
+
+            std::atomic<Signal> signal_;
+
+            std::atomic<bool> closed_;
+            std::atomic<int>  refs_;
+
+            void (*free_)(void*);
+            void (*on_read_)(void*);
+            void* owner_;
+    };
+
+    /*
+     * Resumes coroutines on the co_grpc thread. The default for services whose requests are
+     * taken with `next` or `try_next`, where nothing suspends on the service.
+     *
+     */
+    struct inline_executer {
+
+            inline void
+            execute(void* _awaiter)
+            {
+                std::coroutine_handle<>::from_address(_awaiter).resume();
+            }
+    };
+
+    template <typename Service, typename Executer = inline_executer>
+    class grpc_service {
+
+        public:
+
+            /*
+             * Shared by the requests of one type that are run on the co_grpc thread. Each
+             * `proceed()` there is timed against `_budget`, and after `_strikes` overruns the
+             * lane closes and its requests are queued like any other.
+             *
+             */
+            class inline_lane {
+
+                    friend class grpc_service;
+
+                public:
+
+                    explicit inline_lane(
+                        std::chrono::nanoseconds _budget  = std::chrono::microseconds(2),
+                        std::uint64_t            _strikes = 8) noexcept
+                        : budget_(_budget), strikes_(_strikes), overruns_(0)
+                    { }
+
+                    inline bool
+                    open() const noexcept
+                    {
+                        return overruns_.load(std::memory_order_relaxed) < strikes_;
+                    }
+
+                    inline std::uint64_t
+                    overruns() const noexcept
+                    {
+                        return overruns_.load(std::memory_order_relaxed);
+                    }
+
+                    inline void
+                    reopen() noexcept
+                    {
+                        overruns_.store(0, std::memory_order_relaxed);
+                    }
+
+                private:
+
+                    std::chrono::nanoseconds budget_;
+                    std::uint64_t            strikes_;
+
+                    /* Only added to by the thread draining the queue */
+                    std::atomic<std::uint64_t> overruns_;
+            };
+
+            /*
+             * What a consumer takes from the service with `co_await service`, `next` or
+             * `try_next` and runs with `proceed()`: a `request`, or a timer that has gone off.
+             *
+             */
+            class queued {
+
+                    friend class grpc_service;
+
+                public:
+
+                    queued() noexcept : next_(nullptr) { }
+
+                    virtual ~queued() = default;
+
+                    virtual void
+                    proceed() = 0;
+
+                private:
+
+                    queued* next_;
+
+                    /* Set when this is sampled for the queue delay */
+                    std::chrono::steady_clock::time_point queued_at_;
+            };
+
+            class request : public queued {
+
+                    friend class grpc_service;
+
+                public:
+
+                    request(grpc_service& _service)
+                        : service_(_service), wheel_next_(nullptr), wheel_prev_(nullptr),
+                          expiry_(0), timeout_(0), idle_(false), lane_(nullptr), state_(kNew)
+                    { }
+
+                    virtual ~request(){};
+
+                    void
+                    proceed() final
+                    {
+                        if (state_ != kDestory)
+                        {
+                            if (state_ == kNew)
+                            {
+                                clone();
+                                state_ = kProcessing;
+                                service_.started();
+                            }
+
+                            process();
+                        }
+                        else
+                        {
+                            service_.finished();
+                            destroy();
+                        }
+                    }
+
+                    /* Call just before `Finish`, which is when the load report is attached */
+                    inline void
+                    complete() noexcept
+                    {
+                        if (std::exchange(state_, kDestory) == kProcessing)
+                        {
+                            service_.finishing(ctx_);
+                        }
+                    }
+
+                    inline grpc_service&
+                    server() noexcept
+                    {
+                        return service_;
+                    }
+
+                    inline grpc::ServerContext&
+                    context() noexcept
+                    {
+                        return ctx_;
+                    }
+
+                    /*
+                     * Cancel this request `_timeout` after the service first sees it, which is
+                     * when it arrives if this is set in the constructor. Needs `enable_timeouts`.
+                     *
+                     */
+                    template <typename Rep, typename Period>
+                    void
+                    timeout(std::chrono::duration<Rep, Period> _timeout) noexcept
+                    {
+                        timeout_ = std::chrono::duration_cast<std::chrono::nanoseconds>(_timeout);
+                        idle_    = false;
+                    }
+
+                    /* As `timeout`, but restarted by each completion of this request */
+                    template <typename Rep, typename Period>
+                    void
+                    idle_timeout(std::chrono::duration<Rep, Period> _timeout) noexcept
+                    {
+                        timeout_ = std::chrono::duration_cast<std::chrono::nanoseconds>(_timeout);
+                        idle_    = true;
+                    }
+
+                    /*
+                     * Have the co_grpc thread call `proceed()` itself whenever this request
+                     * completes, rather than queueing it for a consumer, while `_lane` is open.
+                     * For handlers that take less time than the hand over. `process()` must not
+                     * block, as no other rpc is served while it runs.
+                     *
+                     */
+                    inline void
+                    run_inline(inline_lane& _lane) noexcept
+                    {
+                        lane_ = &_lane;
+                    }
+
+                protected:
+
+                    /* For `clone`, the copy keeps the timeout and the lane of `_from` */
+                    request(const request& _from)
+                        : service_(_from.service_), wheel_next_(nullptr), wheel_prev_(nullptr),
+                          expiry_(0), timeout_(_from.timeout_), idle_(_from.idle_),
+                          lane_(_from.lane_), state_(kNew)
+                    { }
+
+                private:
+
+                    virtual void
+                    process() = 0;
+
+                    virtual void
+                    error()
+                    {
+                        destroy();
+                    };
+
+                    virtual void
+                    clone() = 0;
+
+                    virtual void
+                    destroy()
+                    {
+                        delete this;
+                    }
+
+                    grpc_service& service_;
+
+                    grpc::ServerContext ctx_;
+
+                    /* Links into the timer wheel, only touched by the thread draining the queue */
+                    request*      wheel_next_;
+                    request**     wheel_prev_;
+                    std::uint64_t expiry_;
+
+                    std::chrono::nanoseconds timeout_;
+                    bool                     idle_;
+
+                    inline_lane* lane_;
+
+                    enum State {
+                        kNew,
+                        kProcessing,
+                        kDestory
+                    };
+
+                    State state_;
+            };
+
+            /*
+             * Serves a bulk rpc whose messages wrap single messages in a repeated field, such as
+             * one sent by a client `batcher`. Each item is passed in order to `Handler`, called as
+             * `grpc::Status(const Request&, Response&)` like the handler of the single rpc. The
+             * first item that fails fails the whole batch with its status.
+             *
+             */
+            template <
+                typename Request,
+                typename Response,
+                typename BatchRequest,
+                typename BatchResponse,
+                typename Handler>
+            class batch_request : public request {
+
+                public:
+
+                    /* For example `&AsyncService::RequestBatch` */
+                    using register_method = void (Service::*)(
+                        grpc::ServerContext*,
+                        BatchRequest*,
+                        grpc::ServerAsyncResponseWriter<BatchResponse>*,
+                        grpc::CompletionQueue*,
+                        grpc::ServerCompletionQueue*,
+                        void*);
+
+                    /* For example `&HelloBatch::items` and `&HelloBatch::items_size` */
+                    using get_method  = const Request& (BatchRequest::*)(int) const;
+                    using size_method = int (BatchRequest::*)() const;
+
+                    /* For example `&GoodbyeBatch::add_items` */
+                    using add_method = Response* (BatchResponse::*)();
+
+                    batch_request(
+                        grpc_service&   _service,
+                        register_method _register,
+                        get_method      _get,
+                        size_method     _size,
+                        add_method      _add,
+                        Handler         _handler)
+                        : request(_service), responder_(&this->context()), register_(_register),
+                          get_(_get), size_(_size), add_(_add), handler_(std::move(_handler))
+                    {
+                        listen();
+                    }
+
+                private:
+
+                    batch_request(const batch_request& _from)
+                        : request(_from), responder_(&this->context()), register_(_from.register_),
+                          get_(_from.get_), size_(_from.size_), add_(_from.add_),
+                          handler_(_from.handler_)
+                    {
+                        listen();
+                    }
+
+                    /* Register for the next request */
+                    void
+                    listen()
+                    {
+                        (this->server().service().*register_)(
+                            &this->context(),
+                            &request_,
+                            &responder_,
+                            &this->server().completion_queue(),
+                            &this->server().completion_queue(),
+                            (void*) this);
+                    }
+
+                    void
+                    process() override
+                    {
+                        grpc::Status status = grpc::Status::OK;
+
+                        const auto size = (request_.*size_)();
+                        for (int i = 0; i < size && status.ok(); ++i)
+                        {
+                            status = handler_((request_.*get_)(i), *(reply_.*add_)());
+                        }
+
+                        this->complete();
+                        if (status.ok()) { responder_.Finish(reply_, status, this); }
+                        else
+                        {
+                            responder_.FinishWithError(status, this);
+                        }
+                    }
+
+                    void
+                    clone() override
+                    {
+                        new batch_request(*this);
+                    }
+
+                    grpc::ServerAsyncResponseWriter<BatchResponse> responder_;
+
+                    register_method register_;
+                    get_method      get_;
+                    size_method     size_;
+                    add_method      add_;
+
+                    Handler handler_;
+
+                    BatchRequest request_;
+
+                    BatchResponse reply_;
+            };
+
+            /*
+             * Serves a server streaming rpc from a `generator`. `Handler` is called as
+             * `generator<Response>(const Request&)` and the stream is finished with the status it
+             * returns.
+             *
+             * grpc allows a single write in flight per stream, so the generator is run ahead of
+             * the writes instead: up to `_depth` messages are produced into a ring of reused
+             * messages, and each time a write completes the ring is topped up and the next is
+             * written. Yielded messages are moved from.
+             *
+             */
+            template <typename Request, typename Response, typename Handler>
+            class stream_request : public request {
+
+                public:
+
+                    /* For example `&AsyncService::RequestStream` */
+                    using register_method = void (Service::*)(
+                        grpc::ServerContext*,
+                        Request*,
+                        grpc::ServerAsyncWriter<Response>*,
+                        grpc::CompletionQueue*,
+                        grpc::ServerCompletionQueue*,
+                        void*);
+
+                    stream_request(
+                        grpc_service&   _service,
+                        register_method _register,
+                        Handler         _handler,
+                        std::size_t     _depth = 4)
+                        : request(_service), writer_(&this->context()), register_(_register),
+                          handler_(std::move(_handler)),
+                          ring_(std::max<std::size_t>(_depth, 1)), head_(0), count_(0),
+                          done_(false), started_(false)
+                    {
+                        listen();
+                    }
+
+                private:
+
+                    stream_request(const stream_request& _from)
+                        : request(_from), writer_(&this->context()), register_(_from.register_),
+                          handler_(_from.handler_), ring_(_from.ring_.size()), head_(0), count_(0),
+                          done_(false), started_(false)
+                    {
+                        listen();
+                    }
+
+                    /* Register for the next request */
+                    void
+                    listen()
+                    {
+                        (this->server().service().*register_)(
+                            &this->context(),
+                            &request_,
+                            &writer_,
+                            &this->server().completion_queue(),
+                            &this->server().completion_queue(),
+                            (void*) this);
+                    }
+
+                    void
+                    process() override
+                    {
+                        if (!std::exchange(started_, true))
+                        {
+                            generator_ = handler_(std::as_const(request_));
+                        }
+
+                        /*
+                         * A failed write is handled on the co_grpc thread, which may destroy
+                         * this, so the ring is topped up before the next write rather than
+                         * while it is in flight.
+                         *
+                         */
+                        fill();
+                        write();
+                    }
+
+                    void
+                    fill()
+                    {
+                        while (count_ < ring_.size() && !done_)
+                        {
+                            auto* message = generator_.next();
+                            if (!message)
+                            {
+                                done_ = true;
+                                break;
+                            }
+
+                            ring_[(head_ + count_) % ring_.size()] = std::move(*message);
+                            ++count_;
+                        }
+                    }
+
+                    /* Nothing may touch this once it has been written */
+                    void
+                    write()
+                    {
+                        if (count_)
+                        {
+                            const auto at = head_;
+                            head_         = (head_ + 1) % ring_.size();
+                            --count_;
+
+                            /* The message is serialized before this returns */
+                            writer_.Write(ring_[at], this);
+                            return;
+                        }
+
+                        this->complete();
+                        writer_.Finish(generator_.status(), this);
+                    }
+
+                    void
+                    clone() override
+                    {
+                        new stream_request(*this);
+                    }
+
+                    grpc::ServerAsyncWriter<Response> writer_;
+
+                    register_method register_;
+
+                    Handler handler_;
+
+                    Request request_;
+
+                    generator<Response> generator_;
+
+                    std::vector<Response> ring_;
+
+                    std::size_t head_;
+                    std::size_t count_;
+
+                    bool done_;
+                    bool started_;
+            };
+
+            /*
+             * Serves a client streaming rpc whose messages are handed over in batches. `Handler`
+             * is called as `task<grpc::Status>(batch_reader<Request>&, Response&)`, reads with
+             * `co_await reader.read_batch(n)` until it gets an empty batch, and the rpc is
+             * finished with the reply and the status it returns.
+             *
+             */
+            template <typename Request, typename Response, typename Handler>
+            class client_stream_request : public request {
+
+                public:
+
+                    /* For example `&AsyncService::RequestUpload` */
+                    using register_method = void (Service::*)(
+                        grpc::ServerContext*,
+                        grpc::ServerAsyncReader<Response, Request>*,
+                        grpc::CompletionQueue*,
+                        grpc::ServerCompletionQueue*,
+                        void*);
+
+                    client_stream_request(
+                        grpc_service&   _service,
+                        register_method _register,
+                        Handler         _handler,
+                        std::size_t     _max_batch = 256)
+                        : request(_service), stream_(&this->context()), register_(_register),
+                          handler_(std::move(_handler)), reader_(&stream_, _max_batch),
+                          max_batch_(_max_batch)
+                    {
+                        listen();
+                    }
+
+                private:
+
+                    client_stream_request(const client_stream_request& _from)
+                        : request(_from), stream_(&this->context()), register_(_from.register_),
+                          handler_(_from.handler_), reader_(&stream_, _from.max_batch_),
+                          max_batch_(_from.max_batch_)
+                    {
+                        listen();
+                    }
+
+                    /* Register for the next request, and restart an idle timeout on each read */
+                    void
+                    listen()
+                    {
+                        reader_.watch(
+                            [](void* _self) {
+                                auto* self = static_cast<client_stream_request*>(_self);
+                                self->server().active(self);
+                            },
+                            this);
+
+                        (this->server().service().*register_)(
+                            &this->context(),
+                            &stream_,
+                            &this->server().completion_queue(),
+                            &this->server().completion_queue(),
+                            (void*) this);
+                    }
+
+                    /* Only called when the stream arrives, the handler finishes it */
+                    void
+                    process() override
+                    {
+                        task_ = handler_(reader_, reply_);
+                        task_.start(&client_stream_request::finish, this);
+                    }
+
+                    static void
+                    finish(void* _self) noexcept
+                    {
+                        auto* self = static_cast<client_stream_request*>(_self);
+
+                        const grpc::Status status = std::move(self->task_.result());
+
+                        self->complete();
+                        if (status.ok()) { self->stream_.Finish(self->reply_, status, self); }
+                        else
+                        {
+                            self->stream_.FinishWithError(status, self);
+                        }
+                    }
+
+                    void
+                    clone() override
+                    {
+                        new client_stream_request(*this);
+                    }
+
+                    /* Deleted once the reads the handler left behind have drained */
+                    void
+                    destroy() override
+                    {
+                        reader_.close(
+                            [](void* _self) { delete static_cast<client_stream_request*>(_self); },
+                            this);
+                    }
+
+                    grpc::ServerAsyncReader<Response, Request> stream_;
+
+                    register_method register_;
+
+                    Handler handler_;
+
+                    batch_reader<Request> reader_;
+
+                    std::size_t max_batch_;
+
+                    task<grpc::Status> task_;
+
+                    Response reply_;
+            };
+
+            /*
+             * An alarm of the service on its completion queue. It is linked into the service
+             * while it is set, so `clean` can cancel it rather than wait for it to go off, and
+             * it is never set once the service has stopped.
+             *
+             */
+            class timer_base : public completion {
+
+                    friend class grpc_service;
+
+                public:
+
+                    explicit timer_base(grpc_service& _service) noexcept
+                        : service_(_service), timer_next_(nullptr), timer_prev_(nullptr)
+                    { }
+
+                    /* A timer that is set again each time it goes off stays linked */
+                    ~timer_base() override
+                    {
+                        if (timer_prev_) { unlink(); }
+                    }
+
+                protected:
+
+                    /* Link if need be and set the alarm, false if the service has stopped */
+                    template <typename Rep, typename Period>
+                    bool
+                    set(std::chrono::duration<Rep, Period> _duration)
+                    {
+                        std::lock_guard lock(service_.timers_lock_);
+                        if (service_.timers_closed_) { return false; }
+
+                        if (!timer_prev_)
+                        {
+                            timer_next_ = service_.timers_;
+                            timer_prev_ = &service_.timers_;
+                            if (timer_next_) { timer_next_->timer_prev_ = &timer_next_; }
+                            service_.timers_ = this;
+                        }
+
+                        alarm_.Set(
+                            service_.cq_.get(),
+                            std::chrono::system_clock::now() +
+                                std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                                    _duration),
+                            tag());
+
+                        return true;
+                    }
+
+                    void
+                    unlink() noexcept
+                    {
+                        std::lock_guard lock(service_.timers_lock_);
+                        if (!timer_prev_) { return; }
+
+                        *timer_prev_ = timer_next_;
+                        if (timer_next_) { timer_next_->timer_prev_ = timer_prev_; }
+
+                        timer_next_ = nullptr;
+                        timer_prev_ = nullptr;
+                    }
+
+                    grpc_service& service_;
+
+                private:
+
+                    grpc::Alarm alarm_;
+
+                    timer_base*  timer_next_;
+                    timer_base** timer_prev_;
+            };
+
+            /*
+             * A timer that is queued for the consumers of this service when it goes off, so it
+             * is run by them rather than another thread. It carries no `grpc::ServerContext`
+             * and is never started or finished like a request.
+             *
+             */
+            class timer : public timer_base, public queued {
+
+                public:
+
+                    explicit timer(grpc_service& _service) noexcept : timer_base(_service) { }
+
+                private:
+
+                    void
+                    complete(bool _ok, const completion::resumer& _resume) noexcept override
+                    {
+                        this->unlink();
+
+                        if (_ok) { this->service_.queue(this, _resume); }
+                        else
+                        {
+                            /* Cancelled by `clean` */
+                            cancelled(_resume);
+                        }
+                    }
+
+                    virtual void
+                    cancelled(const completion::resumer& _resume) noexcept = 0;
+            };
+
+            /* Lives in the frame of the coroutine that awaits it */
+            class sleep_proxy : public timer {
+
+                public:
+
+                    template <typename Rep, typename Period>
+                    sleep_proxy(
+                        grpc_service&                     _service,
+                        std::chrono::duration<Rep, Period> _duration)
+                        : timer(_service),
+                          duration_(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              _duration)),
+                          awaiter_(nullptr)
+                    { }
+
+                    bool
+                    await_ready() const noexcept
+                    {
+                        return duration_.count() <= 0;
+                    }
+
+                    /* Does not suspend if the service has stopped */
+                    bool
+                    await_suspend(std::coroutine_handle<> _awaiter)
+                    {
+                        awaiter_ = _awaiter.address();
+                        return this->set(duration_);
+                    }
+
+                    void
+                    await_resume() const noexcept
+                    { }
+
+                private:
+
+                    /* Nothing may touch this once the coroutine is resumed */
+                    void
+                    proceed() override
+                    {
+                        std::coroutine_handle<>::from_address(awaiter_).resume();
+                    }
+
+                    void
+                    cancelled(const completion::resumer& _resume) noexcept override
+                    {
+                        _resume(awaiter_);
+                    }
+
+                    std::chrono::nanoseconds duration_;
+
+                    void* awaiter_;
+            };
+
+            template <typename Fn>
+            class delayed : public timer {
+
+                public:
+
+                    delayed(grpc_service& _service, Fn _fn)
+                        : timer(_service), fn_(std::move(_fn))
+                    { }
+
+                private:
+
+                    void
+                    proceed() override
+                    {
+                        fn_();
+                        delete this;
+                    }
+
+                    void
+                    cancelled(const completion::resumer&) noexcept override
+                    {
+                        delete this;
+                    }
+
+                    Fn fn_;
+            };
+
+            template <typename... Args>
+            grpc_service(Args&&... _args)
+                : executer_(std::forward<Args>(_args)...), writer_(nullptr), reader_(nullptr),
+                  reporting_(false), probe_(false), in_flight_(0), pushed_(0), popped_(0),
+                  delay_(0), load_(0), ready_fd_(-1), signalled_(false), spin_(0),
+                  stopped_(false), timers_(nullptr), timers_closed_(false)
+            { }
+
+            ~grpc_service()
+            {
+#if defined(__linux__)
+                if (ready_fd_ >= 0) { ::close(ready_fd_); }
+#endif
+            }
+
+            template <typename Creds>
+            void
+            build(std::string_view _address, Creds&& cred)
+            {
+                grpc::ServerBuilder builder;
+                builder.AddListeningPort(_address.data(), std::forward<Creds>(cred));
+                builder.RegisterService(&service_);
+                cq_     = builder.AddCompletionQueue();
+                server_ = builder.BuildAndStart();
+            }
+
+            template <typename Creds, typename Callback>
+            void
+            build_with_access(std::string_view _address, Creds&& cred, Callback&& _cb)
+            {
+                grpc::ServerBuilder builder;
+                builder.AddListeningPort(_address.data(), std::forward<Creds>(cred));
+                builder.RegisterService(&service_);
+                _cb(builder);
+                cq_     = builder.AddCompletionQueue();
+                server_ = builder.BuildAndStart();
+            }
+
+            void
+            run() & noexcept
+            {
+                thread_ =
+                    std::jthread([this](std::stop_token _stop_token) { do_rpc(_stop_token); });
+            }
+
+            void
+            stop() & noexcept
+            {
+                thread_.request_stop();
+                if (thread_.joinable()) { thread_.join(); }
+            }
+
+            Service&
+            service() & noexcept
+            {
+                return service_;
+            }
+
+            grpc::Server&
+            server() & noexcept
+            {
+                return *server_;
+            }
+
+            grpc::ServerCompletionQueue&
+            completion_queue() & noexcept
+            {
+                return *cq_;
+            }
+
+            /*
+             * Attach the load of this service to the trailing metadata of every rpc under
+             * `kLoadReportKey`. The report is rebuilt on the completion queue every `_refresh`
+             * and the queue delay is sampled from one request per refresh, so a request only
+             * copies the cached report. It is attached when the request calls `complete()`,
+             * just before it finishes.
+             *
+             * Call after `build` and before `run`.
+             *
+             */
+            void
+            report_load(std::chrono::microseconds _refresh = std::chrono::milliseconds(5))
+            {
+                reporting_.store(true, std::memory_order_relaxed);
+                reporter_ = std::make_unique<load_reporter>(*this, _refresh);
+            }
+
+            /*
+             * Track the `timeout` and `idle_timeout` of requests in a hierarchical timer wheel
+             * that is advanced every `_tick` on the completion queue. Requests that expire are
+             * cancelled together once per tick, which fails their pending operations. Timeouts
+             * are rounded up to a whole number of ticks.
+             *
+             * Call after `build` and before `run`.
+             *
+             */
+            void
+            enable_timeouts(std::chrono::microseconds _tick = std::chrono::milliseconds(10))
+            {
+                wheel_  = std::make_unique<timer_wheel>(_tick);
+                ticker_ = std::make_unique<wheel_ticker>(*this, _tick);
+            }
+
+            /*
+             * Suspend for `_duration` with an alarm on the completion queue. The alarm is queued
+             * like a request and the coroutine is resumed by whoever takes it with
+             * `co_await service` and calls `proceed()`. If the service stops first the alarm is
+             * cancelled and the coroutine is resumed early through the executer, or not
+             * suspended at all once it has stopped.
+             *
+             */
+            template <typename Rep, typename Period>
+            sleep_proxy
+            sleep_for(std::chrono::duration<Rep, Period> _duration) &
+            {
+                return sleep_proxy(*this, _duration);
+            }
+
+            /*
+             * Call `_fn()` after `_duration`, taken from the queue like a request. It is not
+             * called if the service stops first.
+             *
+             */
+            template <typename Rep, typename Period, typename Fn>
+            void
+            after(std::chrono::duration<Rep, Period> _duration, Fn&& _fn) &
+            {
+                auto* pending = new delayed<std::decay_t<Fn>>(*this, std::forward<Fn>(_fn));
+                if (!pending->set(_duration)) { delete pending; }
+            }
+
+#if defined(__linux__)
+            /*
+             * Announce queued requests on an eventfd instead of resuming a waiting coroutine, so
+             * the service can be driven from an existing epoll loop. The fd becomes readable
+             * when a request is queued while none were waiting. Take requests with `try_next()`
+             * until it returns `nullptr`, which also resets the fd. Returns the fd, which is
+             * owned by the service, or -1 on failure.
+             *
+             * Call before `run`.
+             *
+             */
+            int
+            enable_readiness() & noexcept
+            {
+                if (ready_fd_ < 0) { ready_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC); }
+                return ready_fd_;
+            }
+#endif
+
+            /*
+             * Take the next queued request without suspending, or `nullptr` if there is none.
+             * Like `co_await service`, only one consumer may take requests at a time.
+             *
+             */
+            queued*
+            try_next() & noexcept
+            {
+                if (!reader_ && !take())
+                {
+                    if (!signalled_.load(std::memory_order_relaxed)) { return nullptr; }
+
+#if defined(__linux__)
+                    eventfd_t value;
+                    ::eventfd_read(ready_fd_, &value);
+#endif
+                    signalled_.store(false, std::memory_order_seq_cst);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                    /* A request queued before the reset did not signal again */
+                    if (!take()) { return nullptr; }
+                }
+
+                return pop();
+            }
+
+            /*
+             * Have a consumer that finds the queue empty check it again `_pauses` times, with a
+             * pause instruction in between, before it suspends or parks. While a consumer spins
+             * the co_grpc thread hands requests over without going through the executer, at
+             * the cost of the consumer's cpu.
+             *
+             * Call before `run`.
+             *
+             */
+            void
+            consumer_spin(std::size_t _pauses) & noexcept
+            {
+                spin_ = _pauses;
+            }
+
+            /*
+             * Take the next queued request, blocking the calling thread on an atomic wait while
+             * there is none. For consumers that are plain threads rather than coroutines.
+             * Returns `nullptr` once the service has stopped and nothing is queued. Like
+             * `co_await service`, only one consumer may take requests at a time.
+             *
+             */
+            queued*
+            next() & noexcept
+            {
+                if (reader_ || (poll() && take())) { return pop(); }
+
+                void* empty  = nullptr;
+                void* parked = reinterpret_cast<void*>(kParkFlag);
+                if (writer_.compare_exchange_strong(
+                        empty,
+                        parked,
+                        std::memory_order_seq_cst,
+                        std::memory_order_acquire))
+                {
+                    /* `clean` sets this before it looks for a parked thread */
+                    if (stopped_.load(std::memory_order_seq_cst))
+                    {
+                        writer_.compare_exchange_strong(
+                            parked,
+                            nullptr,
+                            std::memory_order_acquire,
+                            std::memory_order_acquire);
+                    }
+                    else
+                    {
+                        writer_.wait(parked, std::memory_order_acquire);
+                    }
+                }
+
+                /* Empty if stopped */
+                reverse(writer_.exchange(nullptr, std::memory_order_acquire));
+                return reader_ ? pop() : nullptr;
+            }
+
+            struct await_proxy {
+
+                    std::coroutine_handle<>
+                    await_suspend(std::coroutine_handle<> _awaiter) noexcept
+                    {
+                        void* empty = nullptr;
+                        bool  s     = self_->writer_.compare_exchange_strong(
+                            empty,
+                            reinterpret_cast<void*>(
+                                reinterpret_cast<std::uintptr_t>(_awaiter.address()) | kLockFlag),
+                            std::memory_order_acquire,
+                            std::memory_order_acquire);
+
+                        if (!s) { return _awaiter; }
+                        else
+                        {
+
+                            return std::noop_coroutine();
+                        }
+                    }
+
+                    bool
+                    await_ready() const noexcept
+                    {
+                        return self_->reader_ || self_->poll();
+                    }
+
+                    queued*
+                    await_resume() const noexcept
+                    {
+                        if (!self_->reader_)
+                        {
+                            self_->reverse(
+                                self_->writer_.exchange(nullptr, std::memory_order_acquire));
+                        }
+
+                        return self_->pop();
+                    };
+
+                    grpc_service* self_;
+            };
+
+            await_proxy operator co_await() noexcept { return await_proxy{this}; }
+
+        private:
+
+            friend struct await_proxy;
+
+            /*
+             * Rebuilds the load report each time its alarm goes off. It is run by the thread
+             * draining the completion queue, which is also the only one that queues requests.
+             * It stays on the timer list so `clean` cancels it, and is not set again once the
+             * service has stopped.
+             *
+             */
+            class load_reporter : public timer_base {
+
+                public:
+
+                    load_reporter(grpc_service& _service, std::chrono::microseconds _refresh)
+                        : timer_base(_service), refresh_(_refresh)
+                    {
+                        this->set(refresh_);
+                    }
+
+                private:
+
+                    void
+                    complete(bool _ok, const completion::resumer&) noexcept override
+                    {
+                        /* Cancelled by `clean` */
+                        if (!_ok) { return; }
+
+                        this->service_.refresh();
+                        this->set(refresh_);
+                    }
+
+                    std::chrono::microseconds refresh_;
+            };
+
+            /*
+             * A hashed hierarchical timer wheel over the intrusive links of requests. Level `l`
+             * holds the requests due in less than `kSlots^(l + 1)` ticks, and each time a slot
+             * of a level comes round its requests are cascaded into the levels below. Scheduling,
+             * rescheduling and removal are O(1).
+             *
+             * It is only touched by the thread draining the completion queue.
+             *
+             */
+            class timer_wheel {
+
+                public:
+
+                    explicit timer_wheel(std::chrono::nanoseconds _tick) noexcept
+                        : tick_(std::max(_tick, std::chrono::nanoseconds(1))),
+                          start_(std::chrono::steady_clock::now()), now_(0), count_(0), slots_{}
+                    { }
+
+                    /* The request has completed an operation */
+                    void
+                    schedule(request* _item) noexcept
+                    {
+                        if (!_item->timeout_.count()) { return; }
+
+                        if (_item->wheel_prev_)
+                        {
+                            /* A timeout runs from the first completion */
+                            if (!_item->idle_) { return; }
+
+                            unlink(_item);
+                        }
+                        else if (_item->expiry_ && !_item->idle_)
+                        {
+                            /* Already cancelled */
+                            return;
+                        }
+
+                        /* Nothing has been advancing the wheel */
+                        if (!count_) { now_ = std::max(now_, elapsed()); }
+
+                        const auto ticks = (_item->timeout_ + tick_ - std::chrono::nanoseconds(1)) /
+                                           tick_;
+
+                        _item->expiry_ = now_ + std::max<std::uint64_t>(ticks, 1);
+                        link(_item);
+                    }
+
+                    /* The request is done, a read that completes after it is not scheduled again */
+                    inline void
+                    cancel(request* _item) noexcept
+                    {
+                        if (_item->wheel_prev_) { unlink(_item); }
+                        _item->timeout_ = std::chrono::nanoseconds(0);
+                    }
+
+                    /* Catch up with the clock and cancel everything that expired */
+                    void
+                    advance() noexcept
+                    {
+                        const auto target  = elapsed();
+                        request*   expired = nullptr;
+
+                        while (count_ && now_ < target)
+                        {
+                            ++now_;
+
+                            for (unsigned level = kLevels - 1; level > 0; --level)
+                            {
+                                if (now_ & ((std::uint64_t(1) << (kBits * level)) - 1))
+                                {
+                                    continue;
+                                }
+
+                                auto* item = std::exchange(
+                                    slots_[level][(now_ >> (kBits * level)) & kMask],
+                                    nullptr);
+
+                                while (item)
+                                {
+                                    auto* next = item->wheel_next_;
+
+                                    --count_;
+                                    link(item);
 
-                    virtual ~request(){};
+                                    item = next;
+                                }
+                            }
 
-                    void
-                    proceed()
-                    {
-                        if (state_ != kDestory)
-                        {
-                            if (state_ == kNew)
+                            auto*& head = slots_[0][now_ & kMask];
+                            while (head)
                             {
-                                clone();
-                                state_ = kProcessing;
-                            }
+                                auto* item = head;
+                                unlink(item);
 
-                            process();
+                                item->wheel_next_ = expired;
+                                expired           = item;
+                            }
                         }
-                        else
+
+                        now_ = std::max(now_, target);
+
+                        while (expired)
                         {
-                            destroy();
+                            auto* item        = expired;
+                            expired           = item->wheel_next_;
+                            item->wheel_next_ = nullptr;
+
+                            item->ctx_.TryCancel();
                         }
                     }
 
-                    inline void
-                    complete() noexcept
+                private:
+
+                    static constexpr unsigned      kBits   = 8;
+                    static constexpr unsigned      kLevels = 4;
+                    static constexpr std::uint64_t kSlots  = std::uint64_t(1) << kBits;
+                    static constexpr std::uint64_t kMask   = kSlots - 1;
+
+                    inline std::uint64_t
+                    elapsed() const noexcept
                     {
-                        state_ = kDestory;
+                        return (std::chrono::steady_clock::now() - start_) / tick_;
                     }
 
-                    inline grpc_service&
-                    server() noexcept
+                    void
+                    link(request* _item) noexcept
                     {
-                        return service_;
+                        const auto delta = _item->expiry_ > now_ ? _item->expiry_ - now_ : 0;
+
+                        /* Past the last level it is cascaded again until it is in range */
+                        unsigned level = 0;
+                        while (level < kLevels - 1 && delta >> (kBits * (level + 1))) { ++level; }
+
+                        auto& head = slots_[level][(_item->expiry_ >> (kBits * level)) & kMask];
+
+                        _item->wheel_next_ = head;
+                        _item->wheel_prev_ = &head;
+                        if (head) { head->wheel_prev_ = &_item->wheel_next_; }
+                        head = _item;
+
+                        ++count_;
                     }
 
-                    inline grpc::ServerContext&
-                    context() noexcept
+                    void
+                    unlink(request* _item) noexcept
                     {
-                        return ctx_;
+                        *_item->wheel_prev_ = _item->wheel_next_;
+                        if (_item->wheel_next_)
+                        {
+                            _item->wheel_next_->wheel_prev_ = _item->wheel_prev_;
+                        }
+
+                        _item->wheel_next_ = nullptr;
+                        _item->wheel_prev_ = nullptr;
+
+                        --count_;
                     }
 
-                private:
+                    std::chrono::nanoseconds tick_;
 
-                    virtual void
-                    process() = 0;
+                    std::chrono::steady_clock::time_point start_;
 
-                    virtual void
-                    error()
-                    {
-                        destroy();
-                    };
+                    std::uint64_t now_;
+                    std::uint64_t count_;
 
-                    virtual void
-                    clone() = 0;
+                    request* slots_[kLevels][kSlots];
+            };
 
-                    virtual void
-                    destroy()
+            /*
+             * Advances the timer wheel each time its alarm goes off. Like the load reporter it
+             * stays on the timer list and is not set again once the service has stopped.
+             *
+             */
+            class wheel_ticker : public timer_base {
+
+                public:
+
+                    wheel_ticker(grpc_service& _service, std::chrono::microseconds _tick)
+                        : timer_base(_service), tick_(_tick)
                     {
-                        delete this;
+                        this->set(tick_);
                     }
 
-                    grpc_service& service_;
-
-                    grpc::ServerContext ctx_;
+                private:
 
-                    request* next_;
+                    void
+                    complete(bool _ok, const completion::resumer&) noexcept override
+                    {
+                        /* Cancelled by `clean` */
+                        if (!_ok) { return; }
 
-                    enum State {
-                        kNew,
-                        kProcessing,
-                        kDestory
-                    };
+                        this->service_.wheel_->advance();
+                        this->set(tick_);
+                    }
 
-                    State state_;
+                    std::chrono::microseconds tick_;
             };
 
-            template <typename... Args>
-            grpc_service(Args&&... _args)
-                : executer_(std::forward<Args>(_args)...), writer_(nullptr), reader_(nullptr)
-            { }
-
-            ~grpc_service() = default;
-
-            template <typename Creds>
-            void
-            build(std::string_view _address, Creds&& cred)
+            /*
+             * The report is packed into one word so a request can tell if the copy it formatted
+             * last is still current. Each field saturates at its width.
+             *
+             */
+            static constexpr unsigned      kCountBits = 20;
+            static constexpr unsigned      kDelayBits = 24;
+            static constexpr std::uint64_t kCountMask = (std::uint64_t(1) << kCountBits) - 1;
+            static constexpr std::uint64_t kDelayMask = (std::uint64_t(1) << kDelayBits) - 1;
+
+            static inline std::uint64_t
+            saturate(std::int64_t _value, std::uint64_t _mask) noexcept
             {
-                grpc::ServerBuilder builder;
-                builder.AddListeningPort(_address.data(), std::forward<Creds>(cred));
-                builder.RegisterService(&service_);
-                cq_     = builder.AddCompletionQueue();
-                server_ = builder.BuildAndStart();
+                return std::min(static_cast<std::uint64_t>(std::max<std::int64_t>(_value, 0)),
+                                _mask);
             }
 
-            template <typename Creds, typename Callback>
             void
-            build_with_access(std::string_view _address, Creds&& cred, Callback&& _cb)
+            refresh() noexcept
             {
-                grpc::ServerBuilder builder;
-                builder.AddListeningPort(_address.data(), std::forward<Creds>(cred));
-                builder.RegisterService(&service_);
-                _cb(builder);
-                cq_     = builder.AddCompletionQueue();
-                server_ = builder.BuildAndStart();
+                const auto depth = static_cast<std::int64_t>(
+                    pushed_.load(std::memory_order_relaxed) -
+                    popped_.load(std::memory_order_relaxed));
+
+                /* An empty queue has no delay, however old the last sample is */
+                const auto delay = depth > 0 ? delay_.load(std::memory_order_relaxed) : 0;
+
+                const auto load =
+                    saturate(in_flight_.load(std::memory_order_relaxed), kCountMask) |
+                    saturate(depth, kCountMask) << kCountBits |
+                    saturate(delay, kDelayMask) << (2 * kCountBits);
+
+                load_.store(load, std::memory_order_relaxed);
+                probe_ = true;
             }
 
-            void
-            run() & noexcept
+            inline void
+            started() noexcept
             {
-                thread_ =
-                    std::jthread([this](std::stop_token _stop_token) { do_rpc(_stop_token); });
+                if (reporting_.load(std::memory_order_relaxed))
+                {
+                    in_flight_.fetch_add(1, std::memory_order_relaxed);
+                }
             }
 
+            /*
+             * The key and value are built once and passed by reference. A report is formatted
+             * once per refresh on each thread that attaches it, as the queue thread cannot
+             * replace a shared string while other threads copy it. Both allocate, and if they
+             * fail the rpc finishes without a report.
+             *
+             */
             void
-            stop() & noexcept
+            finishing(grpc::ServerContext& _ctx) noexcept
             {
-                thread_.request_stop();
-                if (thread_.joinable()) { thread_.join(); }
+                if (!reporting_.load(std::memory_order_relaxed)) { return; }
+
+                try
+                {
+                    static const std::string          key(kLoadReportKey);
+                    static thread_local std::uint64_t cached = ~std::uint64_t(0);
+                    static thread_local std::string   report;
+
+                    const auto load = load_.load(std::memory_order_relaxed);
+                    if (load != cached)
+                    {
+                        /* A count followed by a comma stops short of the end */
+                        char buffer[32];
+                        auto last = buffer + sizeof(buffer) - 1;
+                        auto at   = std::to_chars(buffer, last, load & kCountMask).ptr;
+                        *at++     = ',';
+                        at        = std::to_chars(at, last, (load >> kCountBits) & kCountMask).ptr;
+                        *at++     = ',';
+                        at        = std::to_chars(at, last + 1, load >> (2 * kCountBits)).ptr;
+
+                        report.assign(buffer, at);
+                        cached = load;
+                    }
+
+                    _ctx.AddTrailingMetadata(key, report);
+                }
+                catch (...)
+                { }
             }
 
-            Service&
-            service() & noexcept
+            inline void
+            finished() noexcept
             {
-                return service_;
+                if (reporting_.load(std::memory_order_relaxed))
+                {
+                    in_flight_.fetch_sub(1, std::memory_order_relaxed);
+                }
             }
 
-            grpc::Server&
-            server() & noexcept
+            void
+            dequeued(queued* _item) noexcept
             {
-                return *server_;
+                /* Only one consumer takes requests at a time */
+                popped_.store(
+                    popped_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+
+                if (_item->queued_at_ != std::chrono::steady_clock::time_point{})
+                {
+                    const auto delay = std::chrono::steady_clock::now() - _item->queued_at_;
+                    delay_.store(
+                        std::chrono::duration_cast<std::chrono::microseconds>(delay).count(),
+                        std::memory_order_relaxed);
+
+                    _item->queued_at_ = {};
+                }
             }
 
-            grpc::ServerCompletionQueue&
-            completion_queue() & noexcept
+            void
+            do_rpc(std::stop_token _stop_token)
             {
-                return *cq_;
-            }
+                std::stop_callback callback(_stop_token, [this] { clean(); });
 
-            struct await_proxy {
+                void* tag;   // uniquely identifies a request.
+                bool  ok;
 
-                    std::coroutine_handle<>
-                    await_suspend(std::coroutine_handle<> _awaiter) noexcept
+                // The return value of Next should always be checked. This return value tells us
+                // whether there is any kind of event or cq_ is shutting down and drained.
+                if constexpr (batch_executer<Executer>)
+                {
+                    resume_batch<Executer>    batch(executer_);
+                    const completion::resumer resume(batch);
+
+                    /* A deadline in the past only polls */
+                    const std::chrono::system_clock::time_point poll;
+                    while (cq_->Next(&tag, &ok))
                     {
-                        void* empty = nullptr;
-                        bool  s     = self_->writer_.compare_exchange_strong(
-                            empty,
-                            reinterpret_cast<void*>(
-                                reinterpret_cast<std::uintptr_t>(_awaiter.address()) | kLockFlag),
-                            std::memory_order_acquire,
-                            std::memory_order_acquire);
+                        dispatch(tag, ok, resume);
 
-                        if (!s) { return _awaiter; }
-                        else
+                        /* Take what else is ready before handing over what it resumed */
+                        for (std::size_t i = 1; i < batch.capacity() &&
+                                                cq_->AsyncNext(&tag, &ok, poll) ==
+                                                    grpc::CompletionQueue::GOT_EVENT;
+                             ++i)
                         {
-
-                            return std::noop_coroutine();
+                            dispatch(tag, ok, resume);
                         }
+
+                        batch.flush();
                     }
+                }
+                else
+                {
+                    const completion::resumer resume(executer_);
 
-                    bool
-                    await_ready() const noexcept
+                    // Block waiting to read the next event from the completion queue. The event
+                    // is uniquely identified by its tag, which in this case is the memory address
+                    // of a CallData instance.
+                    while (cq_->Next(&tag, &ok))
                     {
-                        return self_->reader_ || self_->writer_.load(std::memory_order_relaxed);
+                        dispatch(tag, ok, resume);
                     }
+                }
+            }
 
-                    request*
-                    await_resume() const noexcept
+            void
+            dispatch(void* _tag, bool _ok, const completion::resumer& _resume)
+            {
+                if (auto* done = completion::from_tag(_tag))
+                {
+                    /* Timers and outbound calls sharing this queue */
+                    done->complete(_ok, _resume);
+                    return;
+                }
+
+                auto* item = (request*) _tag;
+                if (_ok)
+                {
+                    if (wheel_)
                     {
-                        if (!self_->reader_)
+                        if (item->state_ != request::kDestory) { wheel_->schedule(item); }
+                        else
                         {
-                            auto writes =
-                                self_->writer_.exchange(nullptr, std::memory_order_acquire);
-
-                            if (writes)
-                            {
-                                /* Reverse the linked list */
-                                request* next = reinterpret_cast<request*>(writes);
-                                request* temp = nullptr;
-                                do
-                                {
-                                    temp           = next->next_;
-                                    next->next_    = self_->reader_;
-                                    self_->reader_ = next;
-                                    next           = temp;
-
-                                } while (next);
-                            }
+                            wheel_->cancel(item);
                         }
+                    }
 
-                        auto tmp       = self_->reader_;
-                        self_->reader_ = tmp->next_;
-                        return tmp;
-                    };
-
-                    grpc_service* self_;
-            };
-
-            await_proxy operator co_await() noexcept { return await_proxy{this}; }
+                    if (item->lane_ && item->lane_->open()) { run_inline(item); }
+                    else
+                    {
+                        queue(item, _resume);
+                    }
+                }
+                else
+                {
+                    if (item->state_ != request::kNew) { finished(); }
+                    if (wheel_) { wheel_->cancel(item); }
 
-        private:
+                    item->error();
+                }
+            }
 
-            friend struct await_proxy;
+            /* A request made progress without its own tag, such as a chained read */
+            inline void
+            active(request* _item) noexcept
+            {
+                if (wheel_) { wheel_->schedule(_item); }
+            }
 
             void
-            do_rpc(std::stop_token _stop_token)
+            run_inline(request* _item)
             {
-                std::stop_callback callback(_stop_token, [this] { clean(); });
+                /* `proceed` may destroy the request */
+                auto* lane = _item->lane_;
 
-                while (!_stop_token.stop_requested())
-                {
-                    void* tag;   // uniquely identifies a request.
-                    bool  ok;
-                    while (true)
-                    {
-                        // Block waiting to read the next event from the completion queue. The
-                        // event is uniquely identified by its tag, which in this case is the
-                        // memory address of a CallData instance.
-                        // The return value of Next should always be checked. This return value
-                        // tells us whether there is any kind of event or cq_ is shutting down.
-                        GPR_ASSERT(cq_->Next(&tag, &ok));
-
-                        if (ok) { queue((request*) tag); }
-                        else
-                        {
+                const auto start = std::chrono::steady_clock::now();
+                _item->proceed();
 
-                            ((request*) tag)->error();
-                        }
-                    }
+                if (std::chrono::steady_clock::now() - start > lane->budget_)
+                {
+                    lane->overruns_.fetch_add(1, std::memory_order_relaxed);
                 }
             }
 
             void
-            queue(request* _item)
+            queue(queued* _item, const completion::resumer& _resume)
             {
                 if (!_item) { return; }
 
+                if (reporting_.load(std::memory_order_relaxed))
+                {
+                    pushed_.store(
+                        pushed_.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+                    if (probe_)
+                    {
+                        _item->queued_at_ = std::chrono::steady_clock::now();
+                        probe_            = false;
+                    }
+                }
+
                 auto current = writer_.load(std::memory_order_relaxed);
                 do
                 {
@@ -308,19 +2213,27 @@ namespace co_grpc {
                     {
                         const auto address = reinterpret_cast<std::uintptr_t>(current);
 
-                        if (address & kLockFlag)
+                        if (address == kParkFlag)
+                        {
+                            _item->next_ = nullptr;
+                            writer_.store(_item, std::memory_order_release);
+                            writer_.notify_one();
+
+                            return;
+                        }
+                        else if (address & kLockFlag)
                         {
 
                             _item->next_ = nullptr;
                             writer_.store(_item, std::memory_order_release);
 
-                            executer_.execute(reinterpret_cast<void*>(address & ~kLockFlag));
+                            _resume(reinterpret_cast<void*>(address & ~kLockFlag));
 
                             return;
                         }
                         else
                         {
-                            _item->next_ = static_cast<request*>(current);
+                            _item->next_ = static_cast<queued*>(current);
                         }
                     }
                     else
@@ -333,13 +2246,98 @@ namespace co_grpc {
                     _item,
                     std::memory_order_release,
                     std::memory_order_relaxed));
+
+                if (!current && ready_fd_ >= 0)
+                {
+                    /* Pairs with the reset in `try_next` */
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (!signalled_.exchange(true, std::memory_order_seq_cst))
+                    {
+#if defined(__linux__)
+                        ::eventfd_write(ready_fd_, 1);
+#endif
+                    }
+                }
+            }
+
+            /* Whether something is queued, spinning for it first if asked to */
+            bool
+            poll() const noexcept
+            {
+                if (writer_.load(std::memory_order_relaxed)) { return true; }
+
+                for (std::size_t i = 0; i < spin_; ++i)
+                {
+                    cpu_relax();
+                    if (writer_.load(std::memory_order_relaxed)) { return true; }
+                }
+
+                return false;
+            }
+
+            /* Move everything written by `queue` onto the reader list */
+            bool
+            take() noexcept
+            {
+                auto writes = writer_.load(std::memory_order_relaxed);
+                if (!writes || (reinterpret_cast<std::uintptr_t>(writes) & (kLockFlag | kParkFlag)))
+                {
+                    return false;
+                }
+
+                reverse(writer_.exchange(nullptr, std::memory_order_acquire));
+                return reader_;
+            }
+
+            void
+            reverse(void* _writes) noexcept
+            {
+                queued* next = static_cast<queued*>(_writes);
+                while (next)
+                {
+                    queued* temp = next->next_;
+                    next->next_   = reader_;
+                    reader_       = next;
+                    next          = temp;
+                }
+            }
+
+            queued*
+            pop() noexcept
+            {
+                auto tmp = reader_;
+                reader_  = tmp->next_;
+
+                if (reporting_.load(std::memory_order_relaxed)) { dequeued(tmp); }
+
+                return tmp;
             }
 
             void
             clean()
             {
                 server_->Shutdown();
+
+                /* Pending alarms would hold the queue open until they go off */
+                {
+                    std::lock_guard lock(timers_lock_);
+                    timers_closed_ = true;
+                    for (auto* pending = timers_; pending; pending = pending->timer_next_)
+                    {
+                        pending->alarm_.Cancel();
+                    }
+                }
+
                 cq_->Shutdown();
+
+                /* Release a thread parked in `next`, and keep any other from parking */
+                stopped_.store(true, std::memory_order_seq_cst);
+
+                void* parked = reinterpret_cast<void*>(kParkFlag);
+                if (writer_.compare_exchange_strong(parked, nullptr, std::memory_order_seq_cst))
+                {
+                    writer_.notify_one();
+                }
             }
 
             Executer executer_;
@@ -347,12 +2345,49 @@ namespace co_grpc {
             std::jthread thread_;
 
             static constexpr std::uintptr_t kLockFlag = 0b1;
+            static constexpr std::uintptr_t kParkFlag = 0b10;
 
             std::atomic<void*> writer_;
-            request*           reader_;
+            queued*            reader_;
+
+            std::atomic<bool> reporting_;
+
+            /* Only touched by the thread draining the completion queue */
+            bool probe_;
+
+            std::atomic<std::int64_t> in_flight_;
+
+            /*
+             * Requests queued and taken, each written by one thread only. The queue depth is
+             * their difference, as neither side of the queue can count the other.
+             *
+             */
+            std::atomic<std::uint64_t> pushed_;
+            std::atomic<std::uint64_t> popped_;
+
+            std::atomic<std::int64_t> delay_;
+
+            std::atomic<std::uint64_t> load_;
+
+            std::unique_ptr<timer_wheel> wheel_;
+
+            int               ready_fd_;
+            std::atomic<bool> signalled_;
+
+            /* Read only by the consumer */
+            std::size_t spin_;
+
+            std::atomic<bool> stopped_;
+
+            std::mutex  timers_lock_;
+            timer_base* timers_;
+            bool        timers_closed_;
 
             std::unique_ptr<grpc::ServerCompletionQueue> cq_;
 
+            std::unique_ptr<completion> reporter_;
+            std::unique_ptr<completion> ticker_;
+
             Service service_;
 
             std::unique_ptr<grpc::Server> server_;
@@ -0,0 +1,1709 @@
+/*  __    ___         __    ___   ___   __
+ * / /`  / / \  ___  / /`_ | |_) | |_) / /`
+ * \_\_, \_\_/ |___| \_\_/ |_| \ |_|   \_\_,
+ *
+ * MIT License
+ *
+ * Copyright (c) 2021 Donald-Rupin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ *  @file execution.hpp
+ *
+ */
+
+#ifndef CO_GRPC_EXECUTION_HPP_
+#define CO_GRPC_EXECUTION_HPP_
+
+#include <atomic>
+#include <concepts>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * A minimal sender/receiver model in the shape of P2300 (`std::execution`), enough to consume
+ * a `grpc_service` as a sender and to swap schedulers and `Executer`s for one another.
+ *
+ * Customisation is through member functions as in the final revision of the paper: a sender
+ * has `connect`, an operation state has `start`, a receiver has `set_value`, `set_error` and
+ * `set_stopped`, and a scheduler has `schedule`. Senders describe themselves with
+ * `completion_signatures` and may have a single value signature. Errors are
+ * `std::exception_ptr` and there are no environments or stop tokens.
+ *
+ */
+namespace co_grpc::execution {
+
+    struct sender_t { };
+    struct receiver_t { };
+    struct operation_state_t { };
+    struct scheduler_t { };
+
+    struct set_value_t {
+
+            template <typename Receiver, typename... Values>
+            void
+            operator()(Receiver&& _receiver, Values&&... _values) const noexcept
+            {
+                std::forward<Receiver>(_receiver).set_value(std::forward<Values>(_values)...);
+            }
+    };
+
+    struct set_error_t {
+
+            template <typename Receiver, typename Error>
+            void
+            operator()(Receiver&& _receiver, Error&& _error) const noexcept
+            {
+                std::forward<Receiver>(_receiver).set_error(std::forward<Error>(_error));
+            }
+    };
+
+    struct set_stopped_t {
+
+            template <typename Receiver>
+            void
+            operator()(Receiver&& _receiver) const noexcept
+            {
+                std::forward<Receiver>(_receiver).set_stopped();
+            }
+    };
+
+    struct connect_t {
+
+            template <typename Sender, typename Receiver>
+            decltype(auto)
+            operator()(Sender&& _sender, Receiver&& _receiver) const
+            {
+                return std::forward<Sender>(_sender).connect(std::forward<Receiver>(_receiver));
+            }
+    };
+
+    struct start_t {
+
+            template <typename OperationState>
+            void
+            operator()(OperationState& _state) const noexcept
+            {
+                _state.start();
+            }
+    };
+
+    struct schedule_t {
+
+            template <typename Scheduler>
+            decltype(auto)
+            operator()(Scheduler&& _scheduler) const
+            {
+                return std::forward<Scheduler>(_scheduler).schedule();
+            }
+    };
+
+    inline constexpr set_value_t   set_value{};
+    inline constexpr set_error_t   set_error{};
+    inline constexpr set_stopped_t set_stopped{};
+    inline constexpr connect_t     connect{};
+    inline constexpr start_t       start{};
+    inline constexpr schedule_t    schedule{};
+
+    template <typename... Signatures>
+    struct completion_signatures { };
+
+    template <typename Sender>
+    concept sender =
+        std::derived_from<typename std::remove_cvref_t<Sender>::sender_concept, sender_t>;
+
+    template <typename Receiver>
+    concept receiver =
+        std::derived_from<typename std::remove_cvref_t<Receiver>::receiver_concept, receiver_t> &&
+        std::move_constructible<std::remove_cvref_t<Receiver>>;
+
+    template <typename Scheduler>
+    concept scheduler = std::copy_constructible<std::remove_cvref_t<Scheduler>> &&
+                        std::equality_comparable<std::remove_cvref_t<Scheduler>> &&
+                        requires(Scheduler&& _scheduler) {
+                            {
+                                execution::schedule(std::forward<Scheduler>(_scheduler))
+                            } -> sender;
+                        };
+
+    template <typename Sender, typename Receiver>
+    using connect_result_t = decltype(execution::connect(
+        std::declval<Sender>(),
+        std::declval<Receiver>()));
+
+    template <typename Scheduler>
+    using schedule_result_t = decltype(execution::schedule(std::declval<Scheduler>()));
+
+    template <typename... Types>
+    struct type_list { };
+
+    namespace detail {
+
+        template <typename... Signatures>
+        struct find_values {
+                using type = type_list<>;
+        };
+
+        template <typename... Values, typename... Rest>
+        struct find_values<set_value_t(Values...), Rest...> {
+                using type = type_list<std::decay_t<Values>...>;
+        };
+
+        template <typename Signature, typename... Rest>
+        struct find_values<Signature, Rest...> : find_values<Rest...> { };
+
+        template <typename Signatures>
+        struct values_of;
+
+        template <typename... Signatures>
+        struct values_of<completion_signatures<Signatures...>> : find_values<Signatures...> { };
+
+        template <typename Values>
+        struct signatures_for;
+
+        template <typename... Values>
+        struct signatures_for<type_list<Values...>> {
+                using type = completion_signatures<
+                    set_value_t(Values...),
+                    set_error_t(std::exception_ptr),
+                    set_stopped_t()>;
+        };
+
+        template <typename Fn, typename Values>
+        struct invoke_values;
+
+        template <typename Fn, typename... Values>
+        struct invoke_values<Fn, type_list<Values...>> {
+                using result = std::invoke_result_t<Fn&, Values&...>;
+                using type =
+                    std::conditional_t<std::is_void_v<result>, type_list<>, type_list<result>>;
+        };
+
+        template <typename Values>
+        struct tuple_of;
+
+        template <typename... Values>
+        struct tuple_of<type_list<Values...>> {
+                using type = std::tuple<Values...>;
+        };
+
+        template <typename... Lists>
+        struct concat {
+                using type = type_list<>;
+        };
+
+        template <typename... Left, typename... Right, typename... Rest>
+        struct concat<type_list<Left...>, type_list<Right...>, Rest...>
+            : concat<type_list<Left..., Right...>, Rest...> { };
+
+        template <typename... Values>
+        struct concat<type_list<Values...>> {
+                using type = type_list<Values...>;
+        };
+
+        /*
+         * A coroutine nobody waits for, used to hop through an `Executer`. Its frame is placed
+         * in the `frame_` of the operation that starts it, or allocated if it does not fit. Once
+         * the frame is gone it calls `complete()` on the operation, which may then be ended.
+         *
+         */
+        template <typename Operation, std::size_t Size>
+        struct framed {
+
+                struct promise_type;
+
+                struct final_awaiter {
+
+                        bool
+                        await_ready() const noexcept
+                        {
+                            return false;
+                        }
+
+                        void
+                        await_suspend(std::coroutine_handle<promise_type> _frame) const noexcept
+                        {
+                            auto* self = _frame.promise().self_;
+                            _frame.destroy();
+                            self->complete();
+                        }
+
+                        void
+                        await_resume() const noexcept
+                        { }
+                };
+
+                struct promise_type {
+
+                        explicit promise_type(Operation* _self) noexcept : self_(_self) { }
+
+                        static void*
+                        operator new(std::size_t _size, Operation* _self)
+                        {
+                            if (_size <= Size) { return _self->frame_; }
+
+                            return ::operator new(_size);
+                        }
+
+                        static void
+                        operator delete(void* _frame, std::size_t _size) noexcept
+                        {
+                            if (_size > Size) { ::operator delete(_frame, _size); }
+                        }
+
+                        framed
+                        get_return_object() const noexcept
+                        {
+                            return {};
+                        }
+
+                        std::suspend_never
+                        initial_suspend() const noexcept
+                        {
+                            return {};
+                        }
+
+                        final_awaiter
+                        final_suspend() const noexcept
+                        {
+                            return {};
+                        }
+
+                        void
+                        return_void() const noexcept
+                        { }
+
+                        void
+                        unhandled_exception() const noexcept
+                        {
+                            std::terminate();
+                        }
+
+                        Operation* self_;
+                };
+        };
+
+        template <typename Closure>
+        struct closure {
+
+                template <sender Sender>
+                friend auto
+                operator|(Sender&& _sender, closure _closure)
+                {
+                    return std::move(_closure.fn_)(std::forward<Sender>(_sender));
+                }
+
+                Closure fn_;
+        };
+
+        template <typename Closure>
+        closure(Closure) -> closure<Closure>;
+
+    }   // namespace detail
+
+    /* What a sender sends, as a `type_list` */
+    template <sender Sender>
+    using values_of_t = typename detail::values_of<
+        typename std::remove_cvref_t<Sender>::completion_signatures>::type;
+
+    /*
+     * Calls `_fn` with the values sent by `_sender` and sends what it returns. If it throws,
+     * the exception is sent as an error.
+     *
+     */
+    template <sender Sender, typename Fn>
+    class then_sender {
+
+            using values = typename detail::invoke_values<Fn, values_of_t<Sender>>::type;
+
+        public:
+
+            using sender_concept        = sender_t;
+            using completion_signatures = typename detail::signatures_for<values>::type;
+
+            then_sender(Sender _sender, Fn _fn)
+                : sender_(std::move(_sender)), fn_(std::move(_fn))
+            { }
+
+            template <receiver Receiver>
+            auto
+            connect(Receiver _receiver) &&
+            {
+                return execution::connect(
+                    std::move(sender_),
+                    then_receiver<Receiver>{std::move(_receiver), std::move(fn_)});
+            }
+
+        private:
+
+            template <typename Receiver>
+            struct then_receiver {
+
+                    using receiver_concept = receiver_t;
+
+                    template <typename... Values>
+                    void
+                    set_value(Values&&... _values) && noexcept
+                    {
+                        try
+                        {
+                            if constexpr (std::is_void_v<std::invoke_result_t<Fn&, Values&...>>)
+                            {
+                                std::invoke(fn_, _values...);
+                                execution::set_value(std::move(receiver_));
+                            }
+                            else
+                            {
+                                execution::set_value(
+                                    std::move(receiver_),
+                                    std::invoke(fn_, _values...));
+                            }
+                        }
+                        catch (...)
+                        {
+                            execution::set_error(std::move(receiver_), std::current_exception());
+                        }
+                    }
+
+                    template <typename Error>
+                    void
+                    set_error(Error&& _error) && noexcept
+                    {
+                        execution::set_error(std::move(receiver_), std::forward<Error>(_error));
+                    }
+
+                    void
+                    set_stopped() && noexcept
+                    {
+                        execution::set_stopped(std::move(receiver_));
+                    }
+
+                    Receiver receiver_;
+
+                    Fn fn_;
+            };
+
+            Sender sender_;
+
+            Fn fn_;
+    };
+
+    template <sender Sender, typename Fn>
+    then_sender<std::decay_t<Sender>, std::decay_t<Fn>>
+    then(Sender&& _sender, Fn&& _fn)
+    {
+        return {std::forward<Sender>(_sender), std::forward<Fn>(_fn)};
+    }
+
+    template <typename Fn>
+    auto
+    then(Fn&& _fn)
+    {
+        return detail::closure{[fn = std::forward<Fn>(_fn)]<typename Sender>(Sender&& _sender) {
+            return execution::then(std::forward<Sender>(_sender), std::move(fn));
+        }};
+    }
+
+    /*
+     * Calls `_fn(i, values...)` for every `i` in `[0, _shape)` and then sends the values on.
+     * The calls are made one after another, on whichever thread `_sender` completes on. See
+     * `parallel_bulk_sender` to spread them over a scheduler.
+     *
+     */
+    template <sender Sender, std::integral Shape, typename Fn>
+    class bulk_sender {
+
+        public:
+
+            using sender_concept = sender_t;
+            using completion_signatures =
+                typename detail::signatures_for<values_of_t<Sender>>::type;
+
+            bulk_sender(Sender _sender, Shape _shape, Fn _fn)
+                : sender_(std::move(_sender)), shape_(_shape), fn_(std::move(_fn))
+            { }
+
+            template <receiver Receiver>
+            auto
+            connect(Receiver _receiver) &&
+            {
+                return execution::connect(
+                    std::move(sender_),
+                    bulk_receiver<Receiver>{std::move(_receiver), shape_, std::move(fn_)});
+            }
+
+        private:
+
+            template <typename Receiver>
+            struct bulk_receiver {
+
+                    using receiver_concept = receiver_t;
+
+                    template <typename... Values>
+                    void
+                    set_value(Values&&... _values) && noexcept
+                    {
+                        try
+                        {
+                            for (Shape i = 0; i < shape_; ++i)
+                            {
+                                std::invoke(fn_, i, _values...);
+                            }
+                        }
+                        catch (...)
+                        {
+                            execution::set_error(std::move(receiver_), std::current_exception());
+                            return;
+                        }
+
+                        execution::set_value(
+                            std::move(receiver_),
+                            std::forward<Values>(_values)...);
+                    }
+
+                    template <typename Error>
+                    void
+                    set_error(Error&& _error) && noexcept
+                    {
+                        execution::set_error(std::move(receiver_), std::forward<Error>(_error));
+                    }
+
+                    void
+                    set_stopped() && noexcept
+                    {
+                        execution::set_stopped(std::move(receiver_));
+                    }
+
+                    Receiver receiver_;
+
+                    Shape shape_;
+
+                    Fn fn_;
+            };
+
+            Sender sender_;
+
+            Shape shape_;
+
+            Fn fn_;
+    };
+
+    template <sender Sender, std::integral Shape, typename Fn>
+    bulk_sender<std::decay_t<Sender>, Shape, std::decay_t<Fn>>
+    bulk(Sender&& _sender, Shape _shape, Fn&& _fn)
+    {
+        return {std::forward<Sender>(_sender), _shape, std::forward<Fn>(_fn)};
+    }
+
+    template <std::integral Shape, typename Fn>
+    auto
+    bulk(Shape _shape, Fn&& _fn)
+    {
+        return detail::closure{
+            [_shape, fn = std::forward<Fn>(_fn)]<typename Sender>(Sender&& _sender) {
+                return execution::bulk(std::forward<Sender>(_sender), _shape, std::move(fn));
+            }};
+    }
+
+    /*
+     * Calls `_fn(i, values...)` for every `i` in `[0, _shape)` and then sends the values on.
+     * Every call but the first is scheduled on `_scheduler`, and the first is made on whichever
+     * thread `_sender` completes on, so `_fn` must be safe to call concurrently. The values are
+     * sent from the thread of the last call. If a call throws, the first exception is sent
+     * instead, once all calls are done.
+     *
+     */
+    template <sender Sender, scheduler Scheduler, std::integral Shape, typename Fn>
+    class parallel_bulk_sender {
+
+            using values = typename detail::tuple_of<values_of_t<Sender>>::type;
+
+        public:
+
+            using sender_concept = sender_t;
+            using completion_signatures =
+                typename detail::signatures_for<values_of_t<Sender>>::type;
+
+            parallel_bulk_sender(Sender _sender, Scheduler _scheduler, Shape _shape, Fn _fn)
+                : sender_(std::move(_sender)), scheduler_(std::move(_scheduler)), shape_(_shape),
+                  fn_(std::move(_fn))
+            { }
+
+            template <receiver Receiver>
+            auto
+            connect(Receiver _receiver) &&
+            {
+                return operation<Receiver>(
+                    std::move(sender_),
+                    std::move(scheduler_),
+                    shape_,
+                    std::move(fn_),
+                    std::move(_receiver));
+            }
+
+        private:
+
+            template <typename Receiver>
+            class operation {
+
+                public:
+
+                    using operation_state_concept = operation_state_t;
+
+                    operation(
+                        Sender&&    _sender,
+                        Scheduler&& _scheduler,
+                        Shape       _shape,
+                        Fn&&        _fn,
+                        Receiver&&  _receiver)
+                        : scheduler_(std::move(_scheduler)), shape_(_shape), fn_(std::move(_fn)),
+                          receiver_(std::move(_receiver)), remaining_(0), failed_(false),
+                          built_(0),
+                          first_(execution::connect(std::move(_sender), first_receiver{this}))
+                    { }
+
+                    operation(const operation&) = delete;
+
+                    ~operation()
+                    {
+                        for (std::size_t i = 0; i < built_; ++i)
+                        {
+                            task(i)->~task_state();
+                        }
+                    }
+
+                    void
+                    start() noexcept
+                    {
+                        execution::start(first_);
+                    }
+
+                private:
+
+                    struct first_receiver {
+
+                            using receiver_concept = receiver_t;
+
+                            template <typename... Values>
+                            void
+                            set_value(Values&&... _values) && noexcept
+                            {
+                                try
+                                {
+                                    self_->values_.emplace(std::forward<Values>(_values)...);
+                                    self_->spread();
+                                }
+                                catch (...)
+                                {
+                                    execution::set_error(
+                                        std::move(self_->receiver_),
+                                        std::current_exception());
+                                }
+                            }
+
+                            template <typename Error>
+                            void
+                            set_error(Error&& _error) && noexcept
+                            {
+                                execution::set_error(
+                                    std::move(self_->receiver_),
+                                    std::forward<Error>(_error));
+                            }
+
+                            void
+                            set_stopped() && noexcept
+                            {
+                                execution::set_stopped(std::move(self_->receiver_));
+                            }
+
+                            operation* self_;
+                    };
+
+                    struct task_receiver {
+
+                            using receiver_concept = receiver_t;
+
+                            void
+                            set_value() && noexcept
+                            {
+                                self_->call(index_);
+                                self_->arrive();
+                            }
+
+                            void
+                            set_error(std::exception_ptr _error) && noexcept
+                            {
+                                self_->fail(std::move(_error));
+                                self_->arrive();
+                            }
+
+                            void
+                            set_stopped() && noexcept
+                            {
+                                self_->fail(nullptr);
+                                self_->arrive();
+                            }
+
+                            operation* self_;
+                            Shape      index_;
+                    };
+
+                    using first_state = connect_result_t<Sender, first_receiver>;
+                    using task_state =
+                        connect_result_t<schedule_result_t<Scheduler&>, task_receiver>;
+
+                    struct alignas(task_state) task_storage {
+
+                            std::byte bytes_[sizeof(task_state)];
+                    };
+
+                    inline task_state*
+                    task(std::size_t _index) noexcept
+                    {
+                        return std::launder(reinterpret_cast<task_state*>(tasks_[_index].bytes_));
+                    }
+
+                    /* All schedule operations are built before any is started */
+                    void
+                    spread()
+                    {
+                        if (std::cmp_less_equal(shape_, 0))
+                        {
+                            finish();
+                            return;
+                        }
+
+                        const auto count = static_cast<std::size_t>(shape_) - 1;
+                        if (count)
+                        {
+                            tasks_ = std::make_unique_for_overwrite<task_storage[]>(count);
+                        }
+
+                        for (; built_ < count; ++built_)
+                        {
+                            ::new (static_cast<void*>(tasks_[built_].bytes_))
+                                task_state(execution::connect(
+                                    execution::schedule(scheduler_),
+                                    task_receiver{this, static_cast<Shape>(built_ + 1)}));
+                        }
+
+                        remaining_.store(count + 1, std::memory_order_relaxed);
+                        for (std::size_t i = 0; i < count; ++i)
+                        {
+                            execution::start(*task(i));
+                        }
+
+                        call(0);
+                        arrive();
+                    }
+
+                    void
+                    call(Shape _index) noexcept
+                    {
+                        try
+                        {
+                            std::apply(
+                                [&](auto&... _values) { std::invoke(fn_, _index, _values...); },
+                                *values_);
+                        }
+                        catch (...)
+                        {
+                            fail(std::current_exception());
+                        }
+                    }
+
+                    /* Only the first failure is kept, a null one for stopped */
+                    void
+                    fail(std::exception_ptr _error) noexcept
+                    {
+                        if (!failed_.exchange(true, std::memory_order_relaxed))
+                        {
+                            error_ = std::move(_error);
+                        }
+                    }
+
+                    void
+                    arrive() noexcept
+                    {
+                        if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) { finish(); }
+                    }
+
+                    void
+                    finish() noexcept
+                    {
+                        if (!failed_.load(std::memory_order_relaxed))
+                        {
+                            std::apply(
+                                [this](auto&&... _values) {
+                                    execution::set_value(
+                                        std::move(receiver_),
+                                        std::move(_values)...);
+                                },
+                                std::move(*values_));
+                        }
+                        else if (error_)
+                        {
+                            execution::set_error(std::move(receiver_), std::move(error_));
+                        }
+                        else
+                        {
+                            execution::set_stopped(std::move(receiver_));
+                        }
+                    }
+
+                    Scheduler scheduler_;
+
+                    Shape shape_;
+
+                    Fn fn_;
+
+                    Receiver receiver_;
+
+                    std::optional<values> values_;
+
+                    std::atomic<std::size_t> remaining_;
+                    std::atomic<bool>        failed_;
+                    std::exception_ptr       error_;
+
+                    /* One schedule operation for every call but the first */
+                    std::unique_ptr<task_storage[]> tasks_;
+                    std::size_t                     built_;
+
+                    first_state first_;
+            };
+
+            Sender sender_;
+
+            Scheduler scheduler_;
+
+            Shape shape_;
+
+            Fn fn_;
+    };
+
+    template <sender Sender, scheduler Scheduler, std::integral Shape, typename Fn>
+    parallel_bulk_sender<std::decay_t<Sender>, std::decay_t<Scheduler>, Shape, std::decay_t<Fn>>
+    bulk(Sender&& _sender, Scheduler&& _scheduler, Shape _shape, Fn&& _fn)
+    {
+        return {
+            std::forward<Sender>(_sender),
+            std::forward<Scheduler>(_scheduler),
+            _shape,
+            std::forward<Fn>(_fn)};
+    }
+
+    template <scheduler Scheduler, std::integral Shape, typename Fn>
+    auto
+    bulk(Scheduler&& _scheduler, Shape _shape, Fn&& _fn)
+    {
+        return detail::closure{
+            [scheduler = std::forward<Scheduler>(_scheduler),
+             _shape,
+             fn = std::forward<Fn>(_fn)]<typename Sender>(Sender&& _sender) {
+                return execution::bulk(
+                    std::forward<Sender>(_sender),
+                    std::move(scheduler),
+                    _shape,
+                    std::move(fn));
+            }};
+    }
+
+    /* Sends the values of `_sender` from `_scheduler` */
+    template <sender Sender, scheduler Scheduler>
+    class continues_on_sender {
+
+            using values = typename detail::tuple_of<values_of_t<Sender>>::type;
+
+        public:
+
+            using sender_concept = sender_t;
+            using completion_signatures =
+                typename detail::signatures_for<values_of_t<Sender>>::type;
+
+            continues_on_sender(Sender _sender, Scheduler _scheduler)
+                : sender_(std::move(_sender)), scheduler_(std::move(_scheduler))
+            { }
+
+            template <receiver Receiver>
+            auto
+            connect(Receiver _receiver) &&
+            {
+                return operation<Receiver>(
+                    std::move(sender_),
+                    std::move(scheduler_),
+                    std::move(_receiver));
+            }
+
+        private:
+
+            template <typename Receiver>
+            class operation {
+
+                public:
+
+                    using operation_state_concept = operation_state_t;
+
+                    operation(Sender&& _sender, Scheduler&& _scheduler, Receiver&& _receiver)
+                        : scheduler_(std::move(_scheduler)), receiver_(std::move(_receiver)),
+                          first_(execution::connect(std::move(_sender), first_receiver{this})),
+                          hopped_(false)
+                    { }
+
+                    operation(const operation&) = delete;
+
+                    ~operation()
+                    {
+                        if (hopped_) { second()->~second_state(); }
+                    }
+
+                    void
+                    start() noexcept
+                    {
+                        execution::start(first_);
+                    }
+
+                private:
+
+                    struct first_receiver {
+
+                            using receiver_concept = receiver_t;
+
+                            template <typename... Values>
+                            void
+                            set_value(Values&&... _values) && noexcept
+                            {
+                                try
+                                {
+                                    self_->values_.emplace(std::forward<Values>(_values)...);
+                                    self_->hop();
+                                }
+                                catch (...)
+                                {
+                                    execution::set_error(
+                                        std::move(self_->receiver_),
+                                        std::current_exception());
+                                }
+                            }
+
+                            template <typename Error>
+                            void
+                            set_error(Error&& _error) && noexcept
+                            {
+                                execution::set_error(
+                                    std::move(self_->receiver_),
+                                    std::forward<Error>(_error));
+                            }
+
+                            void
+                            set_stopped() && noexcept
+                            {
+                                execution::set_stopped(std::move(self_->receiver_));
+                            }
+
+                            operation* self_;
+                    };
+
+                    struct second_receiver {
+
+                            using receiver_concept = receiver_t;
+
+                            void
+                            set_value() && noexcept
+                            {
+                                std::apply(
+                                    [this](auto&&... _values) {
+                                        execution::set_value(
+                                            std::move(self_->receiver_),
+                                            std::move(_values)...);
+                                    },
+                                    std::move(*self_->values_));
+                            }
+
+                            template <typename Error>
+                            void
+                            set_error(Error&& _error) && noexcept
+                            {
+                                execution::set_error(
+                                    std::move(self_->receiver_),
+                                    std::forward<Error>(_error));
+                            }
+
+                            void
+                            set_stopped() && noexcept
+                            {
+                                execution::set_stopped(std::move(self_->receiver_));
+                            }
+
+                            operation* self_;
+                    };
+
+                    using first_state = connect_result_t<Sender, first_receiver>;
+                    using second_state =
+                        connect_result_t<schedule_result_t<Scheduler&>, second_receiver>;
+
+                    inline second_state*
+                    second() noexcept
+                    {
+                        return std::launder(reinterpret_cast<second_state*>(storage_));
+                    }
+
+                    void
+                    hop()
+                    {
+                        ::new (static_cast<void*>(storage_)) second_state(execution::connect(
+                            execution::schedule(scheduler_),
+                            second_receiver{this}));
+
+                        hopped_ = true;
+                        execution::start(*second());
+                    }
+
+                    Scheduler scheduler_;
+
+                    Receiver receiver_;
+
+                    std::optional<values> values_;
+
+                    first_state first_;
+
+                    /* The schedule operation, built once the values are in */
+                    alignas(second_state) std::byte storage_[sizeof(second_state)];
+                    bool hopped_;
+            };
+
+            Sender sender_;
+
+            Scheduler scheduler_;
+    };
+
+    template <sender Sender, scheduler Scheduler>
+    continues_on_sender<std::decay_t<Sender>, std::decay_t<Scheduler>>
+    continues_on(Sender&& _sender, Scheduler&& _scheduler)
+    {
+        return {std::forward<Sender>(_sender), std::forward<Scheduler>(_scheduler)};
+    }
+
+    template <scheduler Scheduler>
+    auto
+    continues_on(Scheduler&& _scheduler)
+    {
+        return detail::closure{
+            [scheduler = std::forward<Scheduler>(_scheduler)]<typename Sender>(Sender&& _sender) {
+                return execution::continues_on(std::forward<Sender>(_sender), std::move(scheduler));
+            }};
+    }
+
+    /*
+     * Starts every sender and sends all of their values, in order, once the last completes.
+     * If any fails or stops, the first failure is sent instead, after all have completed.
+     *
+     */
+    template <sender... Senders>
+    class when_all_sender {
+
+            using values = typename detail::concat<values_of_t<Senders>...>::type;
+
+        public:
+
+            using sender_concept        = sender_t;
+            using completion_signatures = typename detail::signatures_for<values>::type;
+
+            explicit when_all_sender(Senders... _senders) : senders_(std::move(_senders)...) { }
+
+            template <receiver Receiver>
+            auto
+            connect(Receiver _receiver) &&
+            {
+                return operation<Receiver, std::index_sequence_for<Senders...>>(
+                    std::move(senders_),
+                    std::move(_receiver));
+            }
+
+        private:
+
+            template <typename Receiver, typename Indices>
+            class operation;
+
+            template <typename Receiver, std::size_t... Index>
+            class operation<Receiver, std::index_sequence<Index...>> {
+
+                public:
+
+                    using operation_state_concept = operation_state_t;
+
+                    operation(std::tuple<Senders...>&& _senders, Receiver&& _receiver)
+                        : receiver_(std::move(_receiver)), remaining_(sizeof...(Senders)),
+                          failed_(false),
+                          children_([&] {
+                              return execution::connect(
+                                  std::move(std::get<Index>(_senders)),
+                                  child_receiver<Index>{this});
+                          }...)
+                    { }
+
+                    operation(const operation&) = delete;
+
+                    void
+                    start() noexcept
+                    {
+                        if constexpr (sizeof...(Senders) == 0) { finish(); }
+                        else
+                        {
+                            (execution::start(
+                                 static_cast<child<Index, child_state<Index>>&>(children_).state_),
+                             ...);
+                        }
+                    }
+
+                private:
+
+                    template <std::size_t I>
+                    using sender_at = std::tuple_element_t<I, std::tuple<Senders...>>;
+
+                    template <std::size_t I>
+                    struct child_receiver {
+
+                            using receiver_concept = receiver_t;
+
+                            template <typename... Values>
+                            void
+                            set_value(Values&&... _values) && noexcept
+                            {
+                                try
+                                {
+                                    std::get<I>(self_->values_).emplace(
+                                        std::forward<Values>(_values)...);
+                                }
+                                catch (...)
+                                {
+                                    self_->fail(std::current_exception());
+                                }
+
+                                self_->arrive();
+                            }
+
+                            void
+                            set_error(std::exception_ptr _error) && noexcept
+                            {
+                                self_->fail(std::move(_error));
+                                self_->arrive();
+                            }
+
+                            void
+                            set_stopped() && noexcept
+                            {
+                                self_->fail(nullptr);
+                                self_->arrive();
+                            }
+
+                            operation* self_;
+                    };
+
+                    template <std::size_t I>
+                    using child_state = connect_result_t<sender_at<I>, child_receiver<I>>;
+
+                    template <std::size_t I, typename State>
+                    struct child {
+
+                            template <typename Connect>
+                            explicit child(Connect&& _connect) : state_(_connect())
+                            { }
+
+                            State state_;
+                    };
+
+                    struct children : child<Index, child_state<Index>>... {
+
+                            template <typename... Connects>
+                            explicit children(Connects&&... _connects)
+                                : child<Index, child_state<Index>>(_connects)...
+                            { }
+                    };
+
+                    /* Only the first failure is kept, a null one for stopped */
+                    void
+                    fail(std::exception_ptr _error) noexcept
+                    {
+                        if (!failed_.exchange(true, std::memory_order_relaxed))
+                        {
+                            error_ = std::move(_error);
+                        }
+                    }
+
+                    void
+                    arrive() noexcept
+                    {
+                        if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) { finish(); }
+                    }
+
+                    void
+                    finish() noexcept
+                    {
+                        if (!failed_.load(std::memory_order_relaxed))
+                        {
+                            std::apply(
+                                [this](auto&&... _values) {
+                                    execution::set_value(
+                                        std::move(receiver_),
+                                        std::move(_values)...);
+                                },
+                                std::tuple_cat(std::move(*std::get<Index>(values_))...));
+                        }
+                        else if (error_)
+                        {
+                            execution::set_error(std::move(receiver_), std::move(error_));
+                        }
+                        else
+                        {
+                            execution::set_stopped(std::move(receiver_));
+                        }
+                    }
+
+                    Receiver receiver_;
+
+                    std::tuple<std::optional<
+                        typename detail::tuple_of<values_of_t<sender_at<Index>>>::type>...>
+                        values_;
+
+                    std::atomic<std::size_t> remaining_;
+                    std::atomic<bool>        failed_;
+                    std::exception_ptr       error_;
+
+                    children children_;
+            };
+
+            std::tuple<Senders...> senders_;
+    };
+
+    template <sender... Senders>
+    when_all_sender<std::decay_t<Senders>...>
+    when_all(Senders&&... _senders)
+    {
+        return when_all_sender<std::decay_t<Senders>...>(std::forward<Senders>(_senders)...);
+    }
+
+    namespace detail {
+
+        /*
+         * Lives on the stack of `sync_wait`. It is signalled under the lock, so the waiter cannot
+         * see `done_` and return until the completing thread is done with it.
+         *
+         */
+        template <typename Result>
+        struct wait_state {
+
+                Result             values_;
+                std::exception_ptr error_;
+
+                std::mutex              lock_;
+                std::condition_variable signal_;
+                bool                    done_ = false;
+        };
+
+        template <typename Result>
+        struct wait_receiver {
+
+                using receiver_concept = receiver_t;
+
+                template <typename... Values>
+                void
+                set_value(Values&&... _values) && noexcept
+                {
+                    try
+                    {
+                        state_->values_.emplace(std::forward<Values>(_values)...);
+                    }
+                    catch (...)
+                    {
+                        state_->error_ = std::current_exception();
+                    }
+
+                    done();
+                }
+
+                void
+                set_error(std::exception_ptr _error) && noexcept
+                {
+                    state_->error_ = std::move(_error);
+                    done();
+                }
+
+                void
+                set_stopped() && noexcept
+                {
+                    done();
+                }
+
+                void
+                done() noexcept
+                {
+                    std::lock_guard lck(state_->lock_);
+                    state_->done_ = true;
+                    state_->signal_.notify_one();
+                }
+
+                wait_state<Result>* state_;
+        };
+
+        template <typename Sender>
+        struct detached_holder;
+
+        template <typename Sender>
+        struct detached_receiver {
+
+                using receiver_concept = receiver_t;
+
+                template <typename... Values>
+                void
+                set_value(Values&&...) && noexcept
+                {
+                    delete holder_;
+                }
+
+                template <typename Error>
+                void
+                set_error(Error&&) && noexcept
+                {
+                    std::terminate();
+                }
+
+                void
+                set_stopped() && noexcept
+                {
+                    delete holder_;
+                }
+
+                detached_holder<Sender>* holder_;
+        };
+
+        template <typename Sender>
+        struct detached_holder {
+
+                explicit detached_holder(Sender&& _sender)
+                    : state_(
+                          execution::connect(std::move(_sender), detached_receiver<Sender>{this}))
+                { }
+
+                connect_result_t<Sender, detached_receiver<Sender>> state_;
+        };
+
+    }   // namespace detail
+
+    /*
+     * Blocks until `_sender` completes. Returns its values, nothing if it stopped, and rethrows
+     * its error.
+     *
+     */
+    template <sender Sender>
+    std::optional<typename detail::tuple_of<values_of_t<Sender>>::type>
+    sync_wait(Sender&& _sender)
+    {
+        using result = std::optional<typename detail::tuple_of<values_of_t<Sender>>::type>;
+
+        detail::wait_state<result> state;
+
+        auto operation = execution::connect(
+            std::forward<Sender>(_sender),
+            detail::wait_receiver<result>{&state});
+        execution::start(operation);
+
+        {
+            std::unique_lock lck(state.lock_);
+            state.signal_.wait(lck, [&] { return state.done_; });
+        }
+
+        if (state.error_) { std::rethrow_exception(state.error_); }
+
+        return std::move(state.values_);
+    }
+
+    /* Starts `_sender` and lets it run. It must not fail */
+    template <sender Sender>
+    void
+    start_detached(Sender&& _sender)
+    {
+        using holder = detail::detached_holder<std::decay_t<Sender>>;
+
+        execution::start((new holder(std::decay_t<Sender>(std::forward<Sender>(_sender))))->state_);
+    }
+
+    /*
+     * A scheduler that resumes on a co_grpc `Executer`, such as `pool_executor`. The executer
+     * must outlive the scheduler.
+     *
+     */
+    template <typename Executer>
+    class executer_scheduler {
+
+        public:
+
+            using scheduler_concept = scheduler_t;
+
+            explicit executer_scheduler(Executer& _executer) noexcept : executer_(&_executer) { }
+
+            class schedule_sender {
+
+                public:
+
+                    using sender_concept        = sender_t;
+                    using completion_signatures = execution::completion_signatures<
+                        set_value_t(),
+                        set_error_t(std::exception_ptr),
+                        set_stopped_t()>;
+
+                    template <receiver Receiver>
+                    auto
+                    connect(Receiver _receiver) const
+                    {
+                        return operation<Receiver>(executer_, std::move(_receiver));
+                    }
+
+                private:
+
+                    friend class executer_scheduler;
+
+                    explicit schedule_sender(Executer* _executer) noexcept : executer_(_executer)
+                    { }
+
+                    template <typename Receiver>
+                    class operation {
+
+                        public:
+
+                            using operation_state_concept = operation_state_t;
+
+                            operation(Executer* _executer, Receiver&& _receiver)
+                                : executer_(_executer), receiver_(std::move(_receiver))
+                            { }
+
+                            operation(const operation&) = delete;
+
+                            void
+                            start() noexcept
+                            {
+                                hop(this);
+                            }
+
+                        private:
+
+                            static constexpr std::size_t kFrameSize = 96;
+
+                            friend struct detail::framed<operation, kFrameSize>;
+
+                            struct resume_on {
+
+                                    bool
+                                    await_ready() const noexcept
+                                    {
+                                        return false;
+                                    }
+
+                                    void
+                                    await_suspend(std::coroutine_handle<> _awaiter)
+                                    {
+                                        executer_->execute(_awaiter.address());
+                                    }
+
+                                    void
+                                    await_resume() const noexcept
+                                    { }
+
+                                    Executer* executer_;
+                            };
+
+                            static detail::framed<operation, kFrameSize>
+                            hop(operation* _self)
+                            {
+                                co_await resume_on{_self->executer_};
+                            }
+
+                            void
+                            complete() noexcept
+                            {
+                                execution::set_value(std::move(receiver_));
+                            }
+
+                            Executer* executer_;
+
+                            Receiver receiver_;
+
+                            alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) std::byte frame_[kFrameSize];
+                    };
+
+                    Executer* executer_;
+            };
+
+            schedule_sender
+            schedule() const noexcept
+            {
+                return schedule_sender(executer_);
+            }
+
+            friend bool
+            operator==(const executer_scheduler&, const executer_scheduler&) = default;
+
+        private:
+
+            Executer* executer_;
+    };
+
+    /*
+     * An `Executer` that resumes on a scheduler. A batch of coroutines is resumed from a
+     * single `schedule`. The schedule operations are pooled and reused, and the executer must
+     * outlive the ones it has started.
+     *
+     */
+    template <scheduler Scheduler>
+    class scheduler_executer {
+
+        public:
+
+            explicit scheduler_executer(Scheduler _scheduler)
+                : scheduler_(std::move(_scheduler)), free_(nullptr)
+            { }
+
+            scheduler_executer(const scheduler_executer&) = delete;
+
+            ~scheduler_executer()
+            {
+                while (free_)
+                {
+                    delete std::exchange(free_, free_->next_);
+                }
+            }
+
+            void
+            execute(void* _awaiter)
+            {
+                execute_batch(std::span<void*>(&_awaiter, 1));
+            }
+
+            void
+            execute_batch(std::span<void*> _awaiters)
+            {
+                auto* h = take();
+
+                try
+                {
+                    h->awaiters_.assign(_awaiters.begin(), _awaiters.end());
+                    ::new (static_cast<void*>(h->storage_)) handoff_state(
+                        execution::connect(execution::schedule(scheduler_), handoff_receiver{h}));
+                }
+                catch (...)
+                {
+                    give(h);
+                    throw;
+                }
+
+                execution::start(*h->state());
+            }
+
+        private:
+
+            struct handoff;
+
+            struct handoff_receiver {
+
+                    using receiver_concept = receiver_t;
+
+                    void
+                    set_value() && noexcept
+                    {
+                        auto* h = handoff_;
+                        for (auto* awaiter : h->awaiters_)
+                        {
+                            std::coroutine_handle<>::from_address(awaiter).resume();
+                        }
+
+                        h->owner_->finish(h);
+                    }
+
+                    void
+                    set_error(std::exception_ptr) && noexcept
+                    {
+                        std::terminate();
+                    }
+
+                    void
+                    set_stopped() && noexcept
+                    {
+                        auto* h = handoff_;
+                        h->owner_->finish(h);
+                    }
+
+                    handoff* handoff_;
+            };
+
+            using handoff_state = connect_result_t<schedule_result_t<Scheduler&>, handoff_receiver>;
+
+            /* The awaiters keep their capacity between uses */
+            struct handoff {
+
+                    explicit handoff(scheduler_executer* _owner) noexcept
+                        : next_(nullptr), owner_(_owner)
+                    { }
+
+                    inline handoff_state*
+                    state() noexcept
+                    {
+                        return std::launder(reinterpret_cast<handoff_state*>(storage_));
+                    }
+
+                    handoff*            next_;
+                    scheduler_executer* owner_;
+                    std::vector<void*>  awaiters_;
+
+                    alignas(handoff_state) std::byte storage_[sizeof(handoff_state)];
+            };
+
+            handoff*
+            take()
+            {
+                {
+                    std::lock_guard lck(lock_);
+                    if (free_) { return std::exchange(free_, free_->next_); }
+                }
+
+                return new handoff(this);
+            }
+
+            void
+            give(handoff* _handoff) noexcept
+            {
+                std::lock_guard lck(lock_);
+                _handoff->next_ = free_;
+                free_           = _handoff;
+            }
+
+            /* Called from the receiver, which is gone once the state is */
+            void
+            finish(handoff* _handoff) noexcept
+            {
+                _handoff->state()->~handoff_state();
+                give(_handoff);
+            }
+
+            Scheduler scheduler_;
+
+            std::mutex lock_;
+            handoff*   free_;
+    };
+
+    /*
+     * Sends the next request of a `grpc_service`, as `co_await service` would return it. Like
+     * `co_await service`, only one may be waiting on a service at a time.
+     *
+     */
+    template <typename Service>
+    class request_sender {
+
+            using request_type =
+                decltype(std::declval<Service&>().operator co_await().await_resume());
+
+        public:
+
+            using sender_concept        = sender_t;
+            using completion_signatures = execution::completion_signatures<
+                set_value_t(request_type),
+                set_error_t(std::exception_ptr),
+                set_stopped_t()>;
+
+            explicit request_sender(Service& _service) noexcept : service_(&_service) { }
+
+            template <receiver Receiver>
+            auto
+            connect(Receiver _receiver) const
+            {
+                return operation<Receiver>(service_, std::move(_receiver));
+            }
+
+        private:
+
+            template <typename Receiver>
+            class operation {
+
+                public:
+
+                    using operation_state_concept = operation_state_t;
+
+                    operation(Service* _service, Receiver&& _receiver)
+                        : service_(_service), receiver_(std::move(_receiver)), request_{}
+                    { }
+
+                    operation(const operation&) = delete;
+
+                    void
+                    start() noexcept
+                    {
+                        next(this);
+                    }
+
+                private:
+
+                    static constexpr std::size_t kFrameSize = 128;
+
+                    friend struct detail::framed<operation, kFrameSize>;
+
+                    /* Resumed by the executer of the service when it has to wait */
+                    static detail::framed<operation, kFrameSize>
+                    next(operation* _self)
+                    {
+                        _self->request_ = co_await *_self->service_;
+                    }
+
+                    void
+                    complete() noexcept
+                    {
+                        execution::set_value(std::move(receiver_), request_);
+                    }
+
+                    Service* service_;
+
+                    Receiver receiver_;
+
+                    request_type request_;
+
+                    alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) std::byte frame_[kFrameSize];
+            };
+
+            Service* service_;
+    };
+
+    template <typename Service>
+    request_sender<Service>
+    next_request(Service& _service) noexcept
+    {
+        return request_sender<Service>(_service);
+    }
+
+}   // namespace co_grpc::execution
+
+#endif /* CO_GRPC_EXECUTION_HPP_ */
@@ -0,0 +1,773 @@
+/*  __    ___         __    ___   ___   __
+ * / /`  / / \  ___  / /`_ | |_) | |_) / /`
+ * \_\_, \_\_/ |___| \_\_/ |_| \ |_|   \_\_,
+ *
+ * MIT License
+ *
+ * Copyright (c) 2021 Donald-Rupin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ *  @file executor.hpp
+ *
+ */
+
+#ifndef CO_GRPC_EXECUTOR_HPP_
+#define CO_GRPC_EXECUTOR_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "spin.hpp"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace co_grpc {
+
+    /*
+     * A Chase-Lev work stealing deque of coroutines, as formulated for weak memory models by
+     * Lê, Pop, Cohen and Zappa Nardelli. The owning thread pushes and pops at the bottom and
+     * any thread may steal from the top.
+     *
+     * The ring grows when it is full. Rings that are grown out of are kept until the deque is
+     * destroyed, as a thief may still be reading from one.
+     *
+     */
+    class work_deque {
+
+        public:
+
+            explicit work_deque(std::size_t _capacity = 256)
+                : top_(0), bottom_(0), ring_(nullptr)
+            {
+                std::size_t capacity = 1;
+                while (capacity < _capacity) { capacity <<= 1; }
+
+                rings_.push_back(std::make_unique<ring>(capacity));
+                ring_.store(rings_.back().get(), std::memory_order_relaxed);
+            }
+
+            work_deque(const work_deque&) = delete;
+
+            /* Only the owner */
+            void
+            push(void* _item)
+            {
+                const auto bottom = bottom_.load(std::memory_order_relaxed);
+                const auto top    = top_.load(std::memory_order_acquire);
+                auto*      items  = ring_.load(std::memory_order_relaxed);
+
+                if (bottom - top > static_cast<std::int64_t>(items->mask_))
+                {
+                    items = grow(items, top, bottom);
+                }
+
+                items->put(bottom, _item);
+                std::atomic_thread_fence(std::memory_order_release);
+                bottom_.store(bottom + 1, std::memory_order_relaxed);
+            }
+
+            /* Only the owner, nullptr when empty */
+            void*
+            pop() noexcept
+            {
+                const auto bottom = bottom_.load(std::memory_order_relaxed) - 1;
+                auto*      items  = ring_.load(std::memory_order_relaxed);
+
+                bottom_.store(bottom, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                auto top = top_.load(std::memory_order_relaxed);
+
+                if (top > bottom)
+                {
+                    bottom_.store(bottom + 1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+
+                void* item = items->get(bottom);
+                if (top == bottom)
+                {
+                    /* The last one, race the thieves for it */
+                    if (!top_.compare_exchange_strong(
+                            top,
+                            top + 1,
+                            std::memory_order_seq_cst,
+                            std::memory_order_relaxed))
+                    {
+                        item = nullptr;
+                    }
+
+                    bottom_.store(bottom + 1, std::memory_order_relaxed);
+                }
+
+                return item;
+            }
+
+            /* Any thread, nullptr when empty or when another thread won the race */
+            void*
+            steal() noexcept
+            {
+                auto top = top_.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                const auto bottom = bottom_.load(std::memory_order_acquire);
+
+                if (top >= bottom) { return nullptr; }
+
+                void* item = ring_.load(std::memory_order_acquire)->get(top);
+                if (!top_.compare_exchange_strong(
+                        top,
+                        top + 1,
+                        std::memory_order_seq_cst,
+                        std::memory_order_relaxed))
+                {
+                    return nullptr;
+                }
+
+                return item;
+            }
+
+            inline bool
+            empty() const noexcept
+            {
+                return top_.load(std::memory_order_relaxed) >=
+                       bottom_.load(std::memory_order_relaxed);
+            }
+
+        private:
+
+            struct ring {
+
+                    explicit ring(std::size_t _capacity)
+                        : mask_(_capacity - 1), items_(new std::atomic<void*>[_capacity])
+                    { }
+
+                    inline void
+                    put(std::int64_t _index, void* _item) noexcept
+                    {
+                        items_[_index & mask_].store(_item, std::memory_order_relaxed);
+                    }
+
+                    inline void*
+                    get(std::int64_t _index) const noexcept
+                    {
+                        return items_[_index & mask_].load(std::memory_order_relaxed);
+                    }
+
+                    std::size_t mask_;
+
+                    std::unique_ptr<std::atomic<void*>[]> items_;
+            };
+
+            ring*
+            grow(ring* _items, std::int64_t _top, std::int64_t _bottom)
+            {
+                rings_.push_back(std::make_unique<ring>((_items->mask_ + 1) * 2));
+
+                auto* grown = rings_.back().get();
+                for (auto i = _top; i < _bottom; ++i)
+                {
+                    grown->put(i, _items->get(i));
+                }
+
+                ring_.store(grown, std::memory_order_release);
+                return grown;
+            }
+
+            alignas(64) std::atomic<std::int64_t> top_;
+            alignas(64) std::atomic<std::int64_t> bottom_;
+
+            std::atomic<ring*> ring_;
+
+            std::vector<std::unique_ptr<ring>> rings_;
+    };
+
+    /*
+     * A bounded multi producer multi consumer queue of coroutines, after Vyukov, that spills
+     * into a locked queue when it is full.
+     *
+     */
+    class inject_queue {
+
+        public:
+
+            explicit inject_queue(std::size_t _capacity)
+                : mask_(0), enqueue_(0), dequeue_(0), overflowed_(0)
+            {
+                std::size_t capacity = 2;
+                while (capacity < _capacity) { capacity <<= 1; }
+
+                mask_  = capacity - 1;
+                cells_ = std::make_unique<cell[]>(capacity);
+                for (std::size_t i = 0; i < capacity; ++i)
+                {
+                    cells_[i].sequence_.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            inject_queue(const inject_queue&) = delete;
+
+            void
+            push(void* _awaiter)
+            {
+                auto position = enqueue_.load(std::memory_order_relaxed);
+                while (true)
+                {
+                    auto&      slot     = cells_[position & mask_];
+                    const auto sequence = slot.sequence_.load(std::memory_order_acquire);
+                    const auto diff     = static_cast<std::intptr_t>(sequence - position);
+
+                    if (diff == 0)
+                    {
+                        if (enqueue_.compare_exchange_weak(
+                                position,
+                                position + 1,
+                                std::memory_order_relaxed))
+                        {
+                            slot.awaiter_ = _awaiter;
+                            slot.sequence_.store(position + 1, std::memory_order_release);
+                            return;
+                        }
+                    }
+                    else if (diff < 0)
+                    {
+                        /* Full */
+                        std::lock_guard lock(overflow_lock_);
+                        overflow_.push_back(_awaiter);
+                        overflowed_.fetch_add(1, std::memory_order_release);
+                        return;
+                    }
+                    else
+                    {
+                        position = enqueue_.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            /* nullptr when empty */
+            void*
+            pop() noexcept
+            {
+                auto position = dequeue_.load(std::memory_order_relaxed);
+                while (true)
+                {
+                    auto&      slot     = cells_[position & mask_];
+                    const auto sequence = slot.sequence_.load(std::memory_order_acquire);
+                    const auto diff     = static_cast<std::intptr_t>(sequence - (position + 1));
+
+                    if (diff == 0)
+                    {
+                        if (dequeue_.compare_exchange_weak(
+                                position,
+                                position + 1,
+                                std::memory_order_relaxed))
+                        {
+                            void* awaiter = slot.awaiter_;
+                            slot.sequence_.store(position + mask_ + 1, std::memory_order_release);
+                            return awaiter;
+                        }
+                    }
+                    else if (diff < 0)
+                    {
+                        break;
+                    }
+                    else
+                    {
+                        position = dequeue_.load(std::memory_order_relaxed);
+                    }
+                }
+
+                if (!overflowed_.load(std::memory_order_acquire)) { return nullptr; }
+
+                std::lock_guard lock(overflow_lock_);
+                if (overflow_.empty()) { return nullptr; }
+
+                void* awaiter = overflow_.front();
+                overflow_.pop_front();
+                overflowed_.fetch_sub(1, std::memory_order_relaxed);
+                return awaiter;
+            }
+
+            inline bool
+            empty() const noexcept
+            {
+                return dequeue_.load(std::memory_order_relaxed) ==
+                           enqueue_.load(std::memory_order_relaxed) &&
+                       !overflowed_.load(std::memory_order_relaxed);
+            }
+
+        private:
+
+            struct alignas(64) cell {
+
+                    std::atomic<std::size_t> sequence_;
+
+                    void* awaiter_;
+            };
+
+            std::unique_ptr<cell[]> cells_;
+            std::size_t             mask_;
+
+            alignas(64) std::atomic<std::size_t> enqueue_;
+            alignas(64) std::atomic<std::size_t> dequeue_;
+
+            std::mutex        overflow_lock_;
+            std::deque<void*> overflow_;
+
+            std::atomic<std::size_t> overflowed_;
+    };
+
+    struct thread_pool_options {
+
+            /* Zero for one per hardware thread */
+            std::size_t threads = 0;
+
+            /* How many times an idle worker looks for work before it parks */
+            std::size_t spin = 128;
+
+            /* Pin worker `i` to cpu `first_cpu + i`, wrapping round the cpus there are */
+            bool        pin       = false;
+            std::size_t first_cpu = 0;
+
+            /* Coroutines posted from outside of the pool that fit before it takes a lock */
+            std::size_t inject_capacity = 4096;
+    };
+
+    /*
+     * A work stealing pool of threads that resume coroutines.
+     *
+     * Each worker has a `work_deque`. A worker resuming a coroutine that posts another pushes
+     * it onto its own deque, and coroutines posted from other threads, such as the thread
+     * draining a completion queue, go through a shared bounded queue. An idle worker takes
+     * from its own deque, then the shared queue, then steals from the other workers. It spins
+     * for a while before it parks on an atomic wait, and is woken when there is work and
+     * no other worker is awake to take it.
+     *
+     */
+    class thread_pool {
+
+        public:
+
+            explicit thread_pool(thread_pool_options _options = {})
+                : options_(_options), inject_(_options.inject_capacity), epoch_(0), sleepers_(0),
+                  stopping_(false)
+            {
+                if (!options_.threads)
+                {
+                    options_.threads = std::max(std::thread::hardware_concurrency(), 1u);
+                }
+
+                workers_.reserve(options_.threads);
+                for (std::size_t i = 0; i < options_.threads; ++i)
+                {
+                    workers_.push_back(std::make_unique<worker>(this, i));
+                }
+
+                /* Every deque exists before anything can steal from it */
+                for (auto& each : workers_)
+                {
+                    each->thread_ = std::jthread([this, self = each.get()] { work(*self); });
+                    pin(*each);
+                }
+            }
+
+            thread_pool(const thread_pool&) = delete;
+
+            /* Coroutines that have not been resumed by now are never resumed */
+            ~thread_pool()
+            {
+                stopping_.store(true, std::memory_order_seq_cst);
+                epoch_.fetch_add(1, std::memory_order_release);
+                epoch_.notify_all();
+
+                for (auto& each : workers_)
+                {
+                    each->thread_.join();
+                }
+            }
+
+            /* The pool used by default constructed `pool_executor`s */
+            static thread_pool&
+            shared()
+            {
+                static thread_pool pool;
+                return pool;
+            }
+
+            void
+            post(void* _awaiter)
+            {
+                if (auto* local = current(); local) { local->deque_.push(_awaiter); }
+                else
+                {
+                    inject_.push(_awaiter);
+                }
+
+                wake(1);
+            }
+
+            void
+            post(std::span<void*> _awaiters)
+            {
+                if (_awaiters.empty()) { return; }
+
+                if (auto* local = current(); local)
+                {
+                    for (auto* awaiter : _awaiters)
+                    {
+                        local->deque_.push(awaiter);
+                    }
+                }
+                else
+                {
+                    for (auto* awaiter : _awaiters)
+                    {
+                        inject_.push(awaiter);
+                    }
+                }
+
+                wake(_awaiters.size());
+            }
+
+            inline std::size_t
+            size() const noexcept
+            {
+                return workers_.size();
+            }
+
+        private:
+
+            struct alignas(64) worker {
+
+                    worker(thread_pool* _pool, std::size_t _index)
+                        : pool_(_pool), index_(_index),
+                          seed_(static_cast<std::uint32_t>(_index) * 2654435761u + 1)
+                    { }
+
+                    thread_pool* pool_;
+
+                    std::size_t index_;
+
+                    /* For picking victims */
+                    std::uint32_t seed_;
+
+                    work_deque deque_;
+
+                    std::jthread thread_;
+            };
+
+            static inline thread_local worker* current_ = nullptr;
+
+            inline worker*
+            current() const noexcept
+            {
+                return current_ && current_->pool_ == this ? current_ : nullptr;
+            }
+
+            void
+            work(worker& _self)
+            {
+                current_ = &_self;
+
+                while (true)
+                {
+                    void* awaiter = find(_self);
+
+                    for (std::size_t i = 0; !awaiter && i < options_.spin; ++i)
+                    {
+                        cpu_relax();
+                        awaiter = find(_self);
+                    }
+
+                    if (awaiter)
+                    {
+                        std::coroutine_handle<>::from_address(awaiter).resume();
+                    }
+                    else if (stopping_.load(std::memory_order_acquire))
+                    {
+                        return;
+                    }
+                    else
+                    {
+                        park();
+                    }
+                }
+            }
+
+            void*
+            find(worker& _self) noexcept
+            {
+                if (auto* awaiter = _self.deque_.pop()) { return awaiter; }
+
+                if (auto* awaiter = inject_.pop()) { return awaiter; }
+
+                /* Xorshift, for where to start stealing */
+                _self.seed_ ^= _self.seed_ << 13;
+                _self.seed_ ^= _self.seed_ >> 17;
+                _self.seed_ ^= _self.seed_ << 5;
+
+                const auto size = workers_.size();
+                for (std::size_t i = 0, start = _self.seed_ % size; i < size; ++i)
+                {
+                    auto& victim = *workers_[(start + i) % size];
+                    if (&victim == &_self) { continue; }
+
+                    if (auto* awaiter = victim.deque_.steal()) { return awaiter; }
+                }
+
+                return nullptr;
+            }
+
+            bool
+            pending() const noexcept
+            {
+                if (!inject_.empty()) { return true; }
+
+                for (auto& each : workers_)
+                {
+                    if (!each->deque_.empty()) { return true; }
+                }
+
+                return false;
+            }
+
+            void
+            park()
+            {
+                const auto epoch = epoch_.load(std::memory_order_acquire);
+
+                /* Pairs with the fence in `wake`, one of the two sees the other */
+                sleepers_.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (!pending() && !stopping_.load(std::memory_order_relaxed))
+                {
+                    epoch_.wait(epoch, std::memory_order_acquire);
+                }
+
+                sleepers_.fetch_sub(1, std::memory_order_relaxed);
+            }
+
+            void
+            wake(std::size_t _count) noexcept
+            {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                const auto sleepers = sleepers_.load(std::memory_order_relaxed);
+                if (!sleepers) { return; }
+
+                epoch_.fetch_add(1, std::memory_order_release);
+                if (_count >= sleepers) { epoch_.notify_all(); }
+                else
+                {
+                    for (std::size_t i = 0; i < _count; ++i)
+                    {
+                        epoch_.notify_one();
+                    }
+                }
+            }
+
+            void
+            pin([[maybe_unused]] worker& _worker) noexcept
+            {
+#if defined(__linux__)
+                if (!options_.pin) { return; }
+
+                const auto cpus = std::max(std::thread::hardware_concurrency(), 1u);
+
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET((options_.first_cpu + _worker.index_) % cpus, &set);
+                pthread_setaffinity_np(_worker.thread_.native_handle(), sizeof(set), &set);
+#endif
+            }
+
+            thread_pool_options options_;
+
+            std::vector<std::unique_ptr<worker>> workers_;
+
+            inject_queue inject_;
+
+            alignas(64) std::atomic<std::uint32_t> epoch_;
+            std::atomic<std::size_t>               sleepers_;
+
+            std::atomic<bool> stopping_;
+    };
+
+    /*
+     * An `Executer` that resumes coroutines on a `thread_pool`, by default the shared one
+     * with a worker per hardware thread.
+     *
+     */
+    class pool_executor {
+
+        public:
+
+            pool_executor() : pool_(&thread_pool::shared()) { }
+
+            explicit pool_executor(thread_pool& _pool) noexcept : pool_(&_pool) { }
+
+            inline void
+            execute(void* _awaiter)
+            {
+                pool_->post(_awaiter);
+            }
+
+            inline void
+            execute_batch(std::span<void*> _awaiters)
+            {
+                pool_->post(_awaiters);
+            }
+
+        private:
+
+            thread_pool* pool_;
+    };
+
+#if defined(__linux__)
+    /*
+     * Coroutines to be resumed by an event loop that is already running, such as an epoll
+     * reactor. `fd()` is an eventfd that becomes readable when some are waiting, and the loop
+     * calls `run()` when it is to resume them on its own thread.
+     *
+     */
+    class event_loop {
+
+        public:
+
+            explicit event_loop(std::size_t _capacity = 4096)
+                : fd_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), queue_(_capacity),
+                  signalled_(false)
+            { }
+
+            event_loop(const event_loop&) = delete;
+
+            ~event_loop()
+            {
+                if (fd_ >= 0) { ::close(fd_); }
+            }
+
+            /* To register for reading, it is -1 if the eventfd could not be made */
+            inline int
+            fd() const noexcept
+            {
+                return fd_;
+            }
+
+            void
+            post(void* _awaiter)
+            {
+                queue_.push(_awaiter);
+                signal();
+            }
+
+            void
+            post(std::span<void*> _awaiters)
+            {
+                if (_awaiters.empty()) { return; }
+
+                for (auto* awaiter : _awaiters)
+                {
+                    queue_.push(awaiter);
+                }
+
+                signal();
+            }
+
+            /* Resume what is waiting, returns how many were */
+            std::size_t
+            run()
+            {
+                eventfd_t count;
+                ::eventfd_read(fd_, &count);
+
+                /* Anything posted after this signals again */
+                signalled_.store(false, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                std::size_t resumed = 0;
+                while (auto* awaiter = queue_.pop())
+                {
+                    std::coroutine_handle<>::from_address(awaiter).resume();
+                    ++resumed;
+                }
+
+                return resumed;
+            }
+
+        private:
+
+            /* Only the first post since the loop last ran writes to the eventfd */
+            inline void
+            signal() noexcept
+            {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (!signalled_.exchange(true, std::memory_order_seq_cst))
+                {
+                    ::eventfd_write(fd_, 1);
+                }
+            }
+
+            int fd_;
+
+            inject_queue queue_;
+
+            std::atomic<bool> signalled_;
+    };
+
+    /* An `Executer` that resumes coroutines on an `event_loop` */
+    class event_executor {
+
+        public:
+
+            explicit event_executor(event_loop& _loop) noexcept : loop_(&_loop) { }
+
+            inline void
+            execute(void* _awaiter)
+            {
+                loop_->post(_awaiter);
+            }
+
+            inline void
+            execute_batch(std::span<void*> _awaiters)
+            {
+                loop_->post(_awaiters);
+            }
+
+        private:
+
+            event_loop* loop_;
+    };
+#endif
+}   // namespace co_grpc
+
+#endif /* CO_GRPC_EXECUTOR_HPP_ */
@@ -0,0 +1,48 @@
+/*  __    ___         __    ___   ___   __
+ * / /`  / / \  ___  / /`_ | |_) | |_) / /`
+ * \_\_, \_\_/ |___| \_\_/ |_| \ |_|   \_\_,
+ *
+ * MIT License
+ *
+ * Copyright (c) 2021 Donald-Rupin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ *  @file spin.hpp
+ *
+ */
+
+#ifndef CO_GRPC_SPIN_HPP_
+#define CO_GRPC_SPIN_HPP_
+
+namespace co_grpc {
+
+    /* Tells the cpu this thread is spinning */
+    inline void
+    cpu_relax() noexcept
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield" ::: "memory");
+#endif
+    }
+}   // namespace co_grpc
+
+#endif /* CO_GRPC_SPIN_HPP_ */
@@ -0,0 +1,424 @@
+/*
+ * The client: circuit breaking and rejection, retries, hedging, fan out, the response cache,
+ * waiting for the pool, sharing a service's queue and per thread channels.
+ *
+ */
+
+#include <new>
+
+#include "common.hpp"
+
+using namespace co_grpc_test;
+
+namespace {
+
+    struct tally {
+
+            std::atomic<int> done{0};
+            std::atomic<int> good{0};
+            std::atomic<int> rejected{0};
+
+            void
+            wait(int _count)
+            {
+                wait_for([&] { return done.load(std::memory_order_acquire) == _count; });
+            }
+    };
+
+    template <typename Reply>
+    void
+    record(tally& _tally, const Reply& _reply, const std::string& _value)
+    {
+        if (_reply.status.ok() && _reply.message.value() == _value)
+        {
+            _tally.good.fetch_add(1, std::memory_order_relaxed);
+        }
+        else if (_reply.status.error_message() == "circuit open")
+        {
+            _tally.rejected.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        _tally.done.fetch_add(1, std::memory_order_release);
+    }
+
+    detached
+    echo(client& _client, std::string _value, tally& _tally)
+    {
+        Msg request;
+        request.set_value(_value);
+
+        record(_tally, co_await _client.call(&Stub::AsyncEcho, request), _value);
+    }
+
+    detached
+    retried(client& _client, co_grpc::retry_policy& _policy, std::string _value, tally& _tally)
+    {
+        Msg request;
+        request.set_value(_value);
+
+        record(_tally, co_await _client.retried(_policy, &Stub::AsyncEcho, request), _value);
+    }
+
+    detached
+    hedged(client& _client, co_grpc::hedge_policy& _policy, std::string _value, tally& _tally)
+    {
+        Msg request;
+        request.set_value(_value);
+
+        record(_tally, co_await _client.hedged(_policy, &Stub::AsyncEcho, request), _value);
+    }
+
+    detached
+    first_message(client& _client, std::string& _out, tally& _tally)
+    {
+        Msg request;
+        request.set_value("100000");
+
+        auto stream = _client.stream(&Stub::PrepareAsyncStream, request);
+        auto* first = co_await stream.next();
+        _out        = first ? "message" : stream.status().error_message();
+
+        _tally.done.fetch_add(1, std::memory_order_release);
+    }
+
+    void
+    add_echo_and_stream(service& _service)
+    {
+        new echo_request(_service);
+        new service::stream_request<Msg, Msg, count_handler>(
+            _service,
+            &AsyncService::RequestStream,
+            &count_to);
+    }
+
+    /*
+     * Failures open the circuit, so calls are rejected, awaited directly or through a retry.
+     * After `open_for` a stream is the probe and closes it on its first message.
+     *
+     */
+    void
+    circuit_breaker()
+    {
+        server srv(add_echo_and_stream);
+
+        co_grpc::breaker_options breaker;
+        breaker.min_calls = 2;
+        breaker.open_for  = std::chrono::milliseconds(200);
+
+        client cl;
+        cl.connect(srv.address(), grpc::InsecureChannelCredentials(), {.breaker = breaker});
+        cl.run();
+
+        tally failed;
+        for (int i = 0; i < 3; ++i)
+        {
+            echo(cl, "fail", failed);
+            failed.wait(i + 1);
+        }
+
+        CHECK(failed.rejected.load() >= 1);
+
+        tally open;
+        for (int i = 0; i < 10; ++i) { echo(cl, "x", open); }
+        open.wait(10);
+        CHECK(open.rejected.load() == 10);
+
+        co_grpc::budget       tokens(0.5, 10);
+        co_grpc::retry_policy policy(tokens, {.initial_backoff = std::chrono::microseconds(100)});
+
+        tally retries;
+        for (int i = 0; i < 20; ++i) { retried(cl, policy, "x", retries); }
+        retries.wait(20);
+        CHECK(retries.rejected.load() == 20);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+        std::string first;
+        tally       probe;
+        first_message(cl, first, probe);
+        probe.wait(1);
+        CHECK(first == "message");
+
+        /* Closed by the probe's first message, not by how the stream ends */
+        tally closed;
+        echo(cl, "x", closed);
+        closed.wait(1);
+        CHECK(closed.good.load() == 1);
+
+        cl.stop();
+    }
+
+    void
+    retries()
+    {
+        server srv;
+
+        client cl;
+        cl.connect(srv.address(), grpc::InsecureChannelCredentials());
+        cl.run();
+
+        co_grpc::budget       tokens(1.0, 100);
+        co_grpc::retry_policy policy(
+            tokens,
+            {.max_attempts = 3, .initial_backoff = std::chrono::microseconds(100)});
+
+        tally good;
+        for (int i = 0; i < 50; ++i) { retried(cl, policy, std::to_string(i), good); }
+        good.wait(50);
+        CHECK(good.good.load() == 50);
+
+        tally failing;
+        for (int i = 0; i < 10; ++i) { retried(cl, policy, "fail", failing); }
+        failing.wait(10);
+        CHECK(failing.good.load() == 0);
+
+        const auto stats = policy.stats();
+        CHECK(stats.calls == 60);
+        CHECK(stats.retries > 0);
+        CHECK(stats.exhausted + stats.throttled > 0);
+
+        cl.stop();
+    }
+
+    void
+    hedges()
+    {
+        server srv;
+
+        client cl;
+        cl.connect(
+            srv.address(),
+            grpc::InsecureChannelCredentials(),
+            {.channels = 2, .max_channels = 2});
+        cl.run();
+
+        co_grpc::budget       tokens(0.5, 50);
+        co_grpc::hedge_policy policy(
+            tokens,
+            {.percentile = 0.5, .min_delay = std::chrono::microseconds(50)});
+
+        tally result;
+        for (int i = 0; i < 300; ++i) { hedged(cl, policy, std::to_string(i), result); }
+        result.wait(300);
+        CHECK(result.good.load() == 300);
+
+        cl.stop();
+    }
+
+    detached
+    fan_out(client& _client, tally& _tally)
+    {
+        std::vector<Msg> requests(8);
+        for (std::size_t i = 0; i < requests.size(); ++i)
+        {
+            requests[i].set_value(std::to_string(i));
+        }
+
+        std::vector<client::call_proxy<Msg, Msg>> calls;
+        for (auto& request : requests) { calls.push_back(_client.call(&Stub::AsyncEcho, request)); }
+
+        auto replies = co_await co_grpc::when_all(calls);
+        bool all     = replies.size() == requests.size();
+        for (std::size_t i = 0; all && i < replies.size(); ++i)
+        {
+            all = replies[i].status.ok() && replies[i].message.value() == requests[i].value();
+        }
+
+        Msg a;
+        Msg b;
+        a.set_value("a");
+        b.set_value("b");
+
+        auto [ra, rb] = co_await co_grpc::when_all(
+            _client.call(&Stub::AsyncEcho, a),
+            _client.call(&Stub::AsyncEcho, b));
+        all = all && ra.message.value() == "a" && rb.message.value() == "b";
+
+        std::vector<client::call_proxy<Msg, Msg>> racing;
+        for (auto& request : requests)
+        {
+            racing.push_back(_client.call(&Stub::AsyncEcho, request));
+        }
+
+        auto any = co_await co_grpc::when_any(racing);
+        all      = all && std::any_of(any.begin(), any.end(), [](const auto& _reply) {
+                  return _reply.status.ok();
+              });
+
+        if (all) { _tally.good.fetch_add(1, std::memory_order_relaxed); }
+        _tally.done.fetch_add(1, std::memory_order_release);
+    }
+
+    void
+    fan_outs()
+    {
+        server srv;
+
+        client cl;
+        cl.connect(srv.address(), grpc::InsecureChannelCredentials());
+        cl.run();
+
+        tally result;
+        for (int i = 0; i < 50; ++i) { fan_out(cl, result); }
+        result.wait(50);
+        CHECK(result.good.load() == 50);
+
+        cl.stop();
+    }
+
+    using echo_cache = co_grpc::response_cache<client, Msg, Msg>;
+
+    detached
+    cached(echo_cache& _cache, std::string _value, tally& _tally)
+    {
+        Msg request;
+        request.set_value(_value);
+
+        record(_tally, co_await _cache.call(request), _value);
+    }
+
+    void
+    cache()
+    {
+        server srv;
+
+        client cl;
+        cl.connect(srv.address(), grpc::InsecureChannelCredentials());
+        cl.run();
+
+        /* Split over 16 shards, so any shard could hold every key */
+        echo_cache responses(
+            cl,
+            &Stub::AsyncEcho,
+            {.ttl = std::chrono::seconds(10), .max_entries = 16 * 20});
+
+        const int served = echo_request::served.load();
+
+        tally result;
+        int   total = 0;
+        for (int round = 0; round < 3; ++round)
+        {
+            for (int i = 0; i < 100; ++i)
+            {
+                cached(responses, "k" + std::to_string(i % 20), result);
+                ++total;
+            }
+
+            result.wait(total);
+        }
+
+        CHECK(result.good.load() == total);
+        CHECK(echo_request::served.load() - served <= 20);
+
+        const auto stats = responses.stats();
+        CHECK(stats.hits + stats.coalesced + stats.misses == static_cast<std::uint64_t>(total));
+        CHECK(stats.hits >= 200);
+
+        /* Far past the capacity, so entries are evicted as they are added */
+        for (int i = 0; i < 1000; ++i)
+        {
+            cached(responses, "z" + std::to_string(i), result);
+            ++total;
+        }
+
+        result.wait(total);
+        CHECK(result.good.load() == total);
+
+        responses.clear();
+        cl.stop();
+    }
+
+    detached
+    await_ready(client& _client, tally& _tally)
+    {
+        const bool ready =
+            co_await _client.ready(std::chrono::system_clock::now() + std::chrono::seconds(10));
+        if (ready) { _tally.good.fetch_add(1, std::memory_order_relaxed); }
+
+        _tally.done.fetch_add(1, std::memory_order_release);
+    }
+
+    void
+    ready()
+    {
+        server srv;
+
+        client cl;
+        cl.connect(
+            srv.address(),
+            grpc::InsecureChannelCredentials(),
+            {.channels = 3, .max_channels = 3});
+        cl.run();
+
+        tally result;
+        await_ready(cl, result);
+        result.wait(1);
+        CHECK(result.good.load() == 1);
+
+        cl.stop();
+    }
+
+    /* Outbound completions drained by the service thread, including the checks of `ready` */
+    void
+    attached()
+    {
+        server backend;
+        server front([](service&) { });
+
+        client cl;
+        cl.connect(backend.address(), grpc::InsecureChannelCredentials());
+        cl.attach(front.get());
+
+        tally connected;
+        await_ready(cl, connected);
+        connected.wait(1);
+        CHECK(connected.good.load() == 1);
+
+        tally result;
+        for (int i = 0; i < 200; ++i) { echo(cl, std::to_string(i), result); }
+        result.wait(200);
+        CHECK(result.good.load() == 200);
+    }
+
+    /* Clients made where another was destroyed start from their own channel indices */
+    void
+    per_thread()
+    {
+        server srv;
+
+        alignas(client) unsigned char storage[sizeof(client)];
+        for (int i = 0; i < 50; ++i)
+        {
+            auto* cl = new (storage) client();
+            cl->connect(
+                srv.address(),
+                grpc::InsecureChannelCredentials(),
+                {.channels = 2, .max_channels = 2, .policy = co_grpc::pool_options::kPerThread});
+            cl->run();
+
+            tally result;
+            for (int j = 0; j < 4; ++j) { echo(*cl, std::to_string(j), result); }
+            result.wait(4);
+            CHECK(result.good.load() == 4);
+
+            cl->~client();
+        }
+    }
+
+}   // namespace
+
+int
+main()
+{
+    circuit_breaker();
+    retries();
+    hedges();
+    fan_outs();
+    cache();
+    ready();
+    attached();
+    per_thread();
+
+    std::puts("client_test: ok");
+    return 0;
+}
@@ -0,0 +1,410 @@
+/*
+ * A hand written echo service for the tests, so they need no generated code.
+ *
+ *  Echo    unary                StringValue -> StringValue, fails with UNAVAILABLE for "fail"
+ *  Stream  server streaming     StringValue "n" -> n messages
+ *  Upload  client streaming     StringValue... -> StringValue with the count
+ *  Batch   unary                ListValue -> ListValue, each value echoed
+ *
+ */
+
+#ifndef CO_GRPC_TESTS_COMMON_HPP_
+#define CO_GRPC_TESTS_COMMON_HPP_
+
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/impl/codegen/proto_utils.h>
+#include <grpcpp/impl/rpc_service_method.h>
+#include <grpcpp/impl/service_type.h>
+#include <grpcpp/support/async_stream.h>
+#include <grpcpp/support/async_unary_call.h>
+#include <grpcpp/support/sync_stream.h>
+
+#include <google/protobuf/struct.pb.h>
+#include <google/protobuf/wrappers.pb.h>
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include "co_grpc/client.hpp"
+#include "co_grpc/co_grpc.hpp"
+
+#define CHECK(_expr)                                                                               \
+    do                                                                                             \
+    {                                                                                              \
+        if (!(_expr))                                                                              \
+        {                                                                                          \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #_expr);         \
+            std::abort();                                                                          \
+        }                                                                                          \
+    } while (false)
+
+namespace co_grpc_test {
+
+    using Msg   = google::protobuf::StringValue;
+    using Value = google::protobuf::Value;
+    using List  = google::protobuf::ListValue;
+
+    inline constexpr const char* kEcho   = "/test.Echo/Echo";
+    inline constexpr const char* kStream = "/test.Echo/Stream";
+    inline constexpr const char* kUpload = "/test.Echo/Upload";
+    inline constexpr const char* kBatch  = "/test.Echo/Batch";
+
+    class AsyncService : public grpc::Service {
+
+        public:
+
+            AsyncService()
+            {
+                using grpc::internal::RpcMethod;
+                using grpc::internal::RpcServiceMethod;
+
+                AddMethod(new RpcServiceMethod(kEcho, RpcMethod::NORMAL_RPC, nullptr));
+                AddMethod(new RpcServiceMethod(kStream, RpcMethod::SERVER_STREAMING, nullptr));
+                AddMethod(new RpcServiceMethod(kUpload, RpcMethod::CLIENT_STREAMING, nullptr));
+                AddMethod(new RpcServiceMethod(kBatch, RpcMethod::NORMAL_RPC, nullptr));
+
+                for (int i = 0; i < 4; ++i) { MarkMethodAsync(i); }
+            }
+
+            void
+            RequestEcho(
+                grpc::ServerContext*                     _ctx,
+                Msg*                                     _request,
+                grpc::ServerAsyncResponseWriter<Msg>*    _responder,
+                grpc::CompletionQueue*                   _cq,
+                grpc::ServerCompletionQueue*             _ncq,
+                void*                                    _tag)
+            {
+                RequestAsyncUnary(0, _ctx, _request, _responder, _cq, _ncq, _tag);
+            }
+
+            void
+            RequestStream(
+                grpc::ServerContext*             _ctx,
+                Msg*                             _request,
+                grpc::ServerAsyncWriter<Msg>*    _writer,
+                grpc::CompletionQueue*           _cq,
+                grpc::ServerCompletionQueue*     _ncq,
+                void*                            _tag)
+            {
+                RequestAsyncServerStreaming(1, _ctx, _request, _writer, _cq, _ncq, _tag);
+            }
+
+            void
+            RequestUpload(
+                grpc::ServerContext*                  _ctx,
+                grpc::ServerAsyncReader<Msg, Msg>*    _reader,
+                grpc::CompletionQueue*                _cq,
+                grpc::ServerCompletionQueue*          _ncq,
+                void*                                 _tag)
+            {
+                RequestAsyncClientStreaming(2, _ctx, _reader, _cq, _ncq, _tag);
+            }
+
+            void
+            RequestBatch(
+                grpc::ServerContext*                      _ctx,
+                List*                                     _request,
+                grpc::ServerAsyncResponseWriter<List>*    _responder,
+                grpc::CompletionQueue*                    _cq,
+                grpc::ServerCompletionQueue*              _ncq,
+                void*                                     _tag)
+            {
+                RequestAsyncUnary(3, _ctx, _request, _responder, _cq, _ncq, _tag);
+            }
+    };
+
+    class Stub {
+
+        public:
+
+            explicit Stub(std::shared_ptr<grpc::Channel> _channel)
+                : channel_(std::move(_channel)),
+                  echo_(kEcho, grpc::internal::RpcMethod::NORMAL_RPC, channel_),
+                  stream_(kStream, grpc::internal::RpcMethod::SERVER_STREAMING, channel_),
+                  upload_(kUpload, grpc::internal::RpcMethod::CLIENT_STREAMING, channel_),
+                  batch_(kBatch, grpc::internal::RpcMethod::NORMAL_RPC, channel_)
+            { }
+
+            std::unique_ptr<grpc::ClientAsyncResponseReader<Msg>>
+            AsyncEcho(grpc::ClientContext* _ctx, const Msg& _request, grpc::CompletionQueue* _cq)
+            {
+                return start(echo_, _ctx, _request, _cq);
+            }
+
+            std::unique_ptr<grpc::ClientAsyncResponseReader<List>>
+            AsyncBatch(grpc::ClientContext* _ctx, const List& _request, grpc::CompletionQueue* _cq)
+            {
+                return start(batch_, _ctx, _request, _cq);
+            }
+
+            std::unique_ptr<grpc::ClientAsyncReader<Msg>>
+            PrepareAsyncStream(
+                grpc::ClientContext*   _ctx,
+                const Msg&             _request,
+                grpc::CompletionQueue* _cq)
+            {
+                return std::unique_ptr<grpc::ClientAsyncReader<Msg>>(
+                    grpc::internal::ClientAsyncReaderFactory<Msg>::Create(
+                        channel_.get(),
+                        _cq,
+                        stream_,
+                        _ctx,
+                        _request,
+                        false,
+                        nullptr));
+            }
+
+            /* Blocking, for the tests that pace the messages themselves */
+            std::unique_ptr<grpc::ClientWriter<Msg>>
+            Upload(grpc::ClientContext* _ctx, Msg* _response)
+            {
+                return std::unique_ptr<grpc::ClientWriter<Msg>>(
+                    grpc::internal::ClientWriterFactory<Msg>::Create(
+                        channel_.get(),
+                        upload_,
+                        _ctx,
+                        _response));
+            }
+
+        private:
+
+            template <typename Request, typename Response = Request>
+            std::unique_ptr<grpc::ClientAsyncResponseReader<Response>>
+            start(
+                const grpc::internal::RpcMethod& _method,
+                grpc::ClientContext*             _ctx,
+                const Request&                   _request,
+                grpc::CompletionQueue*           _cq)
+            {
+                auto reader = std::unique_ptr<grpc::ClientAsyncResponseReader<Response>>(
+                    grpc::internal::ClientAsyncResponseReaderHelper::Create<Response>(
+                        channel_.get(),
+                        _cq,
+                        _method,
+                        _ctx,
+                        _request));
+
+                reader->StartCall();
+                return reader;
+            }
+
+            std::shared_ptr<grpc::Channel> channel_;
+
+            grpc::internal::RpcMethod echo_;
+            grpc::internal::RpcMethod stream_;
+            grpc::internal::RpcMethod upload_;
+            grpc::internal::RpcMethod batch_;
+    };
+
+    using service = co_grpc::grpc_service<AsyncService>;
+    using client  = co_grpc::grpc_client<Stub, co_grpc::inline_executer>;
+
+    /* A coroutine nobody waits for */
+    struct detached {
+
+            struct promise_type {
+
+                    detached
+                    get_return_object() noexcept
+                    {
+                        return {};
+                    }
+
+                    std::suspend_never
+                    initial_suspend() noexcept
+                    {
+                        return {};
+                    }
+
+                    std::suspend_never
+                    final_suspend() noexcept
+                    {
+                        return {};
+                    }
+
+                    void
+                    return_void() noexcept
+                    { }
+
+                    void
+                    unhandled_exception() noexcept
+                    {
+                        std::terminate();
+                    }
+            };
+    };
+
+    /* Serves `Echo`, with an optional delay before it replies */
+    class echo_request : public service::request {
+
+        public:
+
+            static inline std::atomic<int> served{0};
+
+            explicit echo_request(
+                service&                  _service,
+                std::chrono::milliseconds _delay = {},
+                service::inline_lane*     _lane  = nullptr)
+                : service::request(_service), responder_(&this->context()), delay_(_delay),
+                  lane_(_lane)
+            {
+                /* Before it is registered, as it may arrive at once */
+                if (lane_) { run_inline(*lane_); }
+
+                server().service().RequestEcho(
+                    &this->context(),
+                    &request_,
+                    &responder_,
+                    &server().completion_queue(),
+                    &server().completion_queue(),
+                    this);
+            }
+
+        private:
+
+            void
+            process() override
+            {
+                served.fetch_add(1, std::memory_order_relaxed);
+                if (delay_.count()) { std::this_thread::sleep_for(delay_); }
+
+                reply_.set_value(request_.value());
+
+                complete();
+                if (request_.value() == "fail")
+                {
+                    responder_.FinishWithError(
+                        grpc::Status(grpc::StatusCode::UNAVAILABLE, "fail"),
+                        this);
+                }
+                else
+                {
+                    responder_.Finish(reply_, grpc::Status::OK, this);
+                }
+            }
+
+            void
+            clone() override
+            {
+                new echo_request(server(), delay_, lane_);
+            }
+
+            grpc::ServerAsyncResponseWriter<Msg> responder_;
+
+            std::chrono::milliseconds delay_;
+
+            service::inline_lane* lane_;
+
+            Msg request_;
+            Msg reply_;
+    };
+
+    inline co_grpc::generator<Msg>
+    count_to(const Msg& _request)
+    {
+        const int count = std::stoi(_request.value());
+
+        Msg message;
+        for (int i = 0; i < count; ++i)
+        {
+            message.set_value(std::to_string(i));
+            co_yield message;
+        }
+
+        co_return grpc::Status::OK;
+    }
+
+    using count_handler = co_grpc::generator<Msg> (*)(const Msg&);
+
+    /* Wait until `_done` holds, or fail the test after `_limit` */
+    template <typename Done>
+    void
+    wait_for(Done&& _done, std::chrono::seconds _limit = std::chrono::seconds(30))
+    {
+        const auto until = std::chrono::steady_clock::now() + _limit;
+        while (!_done())
+        {
+            CHECK(std::chrono::steady_clock::now() < until);
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+
+    /*
+     * A service on an ephemeral port with one consumer thread. `_setup` runs after `build` and
+     * before `run`, to enable features and add requests.
+     *
+     */
+    class server {
+
+        public:
+
+            template <typename Setup>
+            explicit server(Setup&& _setup)
+            {
+                service_.build_with_access(
+                    "127.0.0.1:0",
+                    grpc::InsecureServerCredentials(),
+                    [this](grpc::ServerBuilder& _builder) {
+                        _builder.AddListeningPort(
+                            "127.0.0.1:0",
+                            grpc::InsecureServerCredentials(),
+                            &port_);
+                    });
+
+                _setup(service_);
+                service_.run();
+
+                consumer_ = std::thread([this] {
+                    while (auto* item = service_.next()) { item->proceed(); }
+                });
+            }
+
+            server() : server([](service& _service) { new echo_request(_service); }) { }
+
+            /*
+             * Hedges and races cancel their losers, which may still be queued. Nothing may be
+             * started on the queue once it is shut down, so let them be served first.
+             *
+             */
+            ~server()
+            {
+                for (int served = -1; served != echo_request::served.load();)
+                {
+                    served = echo_request::served.load();
+                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                }
+
+                service_.stop();
+                consumer_.join();
+            }
+
+            inline service&
+            get() noexcept
+            {
+                return service_;
+            }
+
+            std::string
+            address() const
+            {
+                return "127.0.0.1:" + std::to_string(port_);
+            }
+
+        private:
+
+            service service_;
+
+            std::thread consumer_;
+
+            int port_ = 0;
+    };
+
+}   // namespace co_grpc_test
+
+#endif /* CO_GRPC_TESTS_COMMON_HPP_ */
@@ -0,0 +1,208 @@
+/*
+ * The sender layer: scheduling onto a pool, `then`, both forms of `bulk`, `continues_on`,
+ * `when_all`, errors through `sync_wait`, `start_detached` and `next_request`.
+ *
+ */
+
+#include <stdexcept>
+
+#include "common.hpp"
+#include "co_grpc/execution.hpp"
+#include "co_grpc/executor.hpp"
+
+using namespace co_grpc_test;
+
+namespace ex = co_grpc::execution;
+
+namespace {
+
+    using pool_scheduler = ex::executer_scheduler<co_grpc::pool_executor>;
+
+    void
+    then_on_pool(pool_scheduler& _scheduler)
+    {
+        long total = 0;
+        for (int i = 0; i < 20000; ++i)
+        {
+            auto [value] = *ex::sync_wait(ex::schedule(_scheduler) | ex::then([i] { return i; }));
+            total += value;
+        }
+
+        CHECK(total == 20000L * 19999 / 2);
+    }
+
+    void
+    bulk(pool_scheduler& _scheduler)
+    {
+        std::vector<int> items(1000, 1);
+
+        std::atomic<int> parallel{0};
+        for (int round = 0; round < 200; ++round)
+        {
+            ex::sync_wait(
+                ex::schedule(_scheduler) |
+                ex::bulk(_scheduler, items.size(), [&](std::size_t _index) {
+                    parallel.fetch_add(items[_index], std::memory_order_relaxed);
+                }));
+        }
+
+        CHECK(parallel.load() == 200 * 1000);
+
+        int  serial = 0;
+        auto [sent] = *ex::sync_wait(
+            ex::schedule(_scheduler) | ex::then([] { return 7; }) |
+            ex::bulk(items.size(), [&](std::size_t _index, int) { serial += items[_index]; }));
+
+        CHECK(serial == 1000);
+        CHECK(sent == 7);
+    }
+
+    void
+    continues_on(pool_scheduler& _first, pool_scheduler& _second)
+    {
+        for (int i = 0; i < 1000; ++i)
+        {
+            auto [ids] = *ex::sync_wait(
+                ex::schedule(_first) | ex::then([] { return std::this_thread::get_id(); }) |
+                ex::continues_on(_second) | ex::then([](std::thread::id _before) {
+                    return std::make_pair(_before, std::this_thread::get_id());
+                }));
+
+            const auto [a, b] = ids;
+            CHECK(a != std::this_thread::get_id());
+            CHECK(b != std::this_thread::get_id());
+        }
+    }
+
+    void
+    when_all(pool_scheduler& _scheduler)
+    {
+        for (int i = 0; i < 1000; ++i)
+        {
+            auto [a, b] = *ex::sync_wait(ex::when_all(
+                ex::schedule(_scheduler) | ex::then([i] { return i; }),
+                ex::schedule(_scheduler) | ex::then([i] { return i * 2; })));
+
+            CHECK(a == i);
+            CHECK(b == i * 2);
+        }
+    }
+
+    void
+    errors(pool_scheduler& _scheduler)
+    {
+        bool caught = false;
+        try
+        {
+            ex::sync_wait(ex::schedule(_scheduler) | ex::then([]() -> int {
+                              throw std::runtime_error("failed");
+                          }));
+        }
+        catch (const std::runtime_error& _error)
+        {
+            caught = std::string(_error.what()) == "failed";
+        }
+
+        CHECK(caught);
+    }
+
+    void
+    detached_work(pool_scheduler& _scheduler)
+    {
+        std::atomic<int> ran{0};
+        for (int i = 0; i < 10000; ++i)
+        {
+            ex::start_detached(ex::schedule(_scheduler) | ex::then([&ran] {
+                                   ran.fetch_add(1, std::memory_order_release);
+                               }));
+        }
+
+        wait_for([&] { return ran.load(std::memory_order_acquire) == 10000; });
+    }
+
+    detached
+    echo(client& _client, std::atomic<int>& _good, std::atomic<int>& _done)
+    {
+        Msg request;
+        request.set_value("x");
+
+        auto reply = co_await _client.call(&Stub::AsyncEcho, request);
+        if (reply.status.ok() && reply.message.value() == "x")
+        {
+            _good.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        _done.fetch_add(1, std::memory_order_release);
+    }
+
+    /* Each unary rpc is taken twice, when it arrives and when it has finished */
+    void
+    next_request(pool_scheduler& _scheduler)
+    {
+        constexpr int kCalls = 200;
+
+        service svc;
+        int     port = 0;
+        svc.build_with_access(
+            "127.0.0.1:0",
+            grpc::InsecureServerCredentials(),
+            [&](grpc::ServerBuilder& _builder) {
+                _builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &port);
+            });
+        new echo_request(svc);
+        svc.run();
+
+        std::atomic<int> handled{0};
+        std::thread      consumer([&] {
+            for (int i = 0; i < kCalls * 2; ++i)
+            {
+                auto [item] = *ex::sync_wait(ex::next_request(svc));
+                ex::start_detached(ex::schedule(_scheduler) | ex::then([item, &handled] {
+                                       item->proceed();
+                                       handled.fetch_add(1, std::memory_order_release);
+                                   }));
+            }
+        });
+
+        client cl;
+        cl.connect("127.0.0.1:" + std::to_string(port), grpc::InsecureChannelCredentials());
+        cl.run();
+
+        std::atomic<int> good{0};
+        std::atomic<int> done{0};
+        for (int i = 0; i < kCalls; ++i) { echo(cl, good, done); }
+
+        wait_for([&] { return done.load(std::memory_order_acquire) == kCalls; });
+        CHECK(good.load() == kCalls);
+
+        consumer.join();
+        wait_for([&] { return handled.load(std::memory_order_acquire) == kCalls * 2; });
+
+        cl.stop();
+        svc.stop();
+    }
+
+}   // namespace
+
+int
+main()
+{
+    co_grpc::thread_pool   first_pool({.threads = 4});
+    co_grpc::thread_pool   second_pool({.threads = 2});
+    co_grpc::pool_executor first_executor(first_pool);
+    co_grpc::pool_executor second_executor(second_pool);
+
+    pool_scheduler first(first_executor);
+    pool_scheduler second(second_executor);
+
+    then_on_pool(first);
+    bulk(first);
+    continues_on(first, second);
+    when_all(first);
+    errors(first);
+    detached_work(first);
+    next_request(first);
+
+    std::puts("execution_test: ok");
+    return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * Stress tests of the work stealing deque, the injection queue and the thread pool built on
+ * them. Every item must be taken exactly once.
+ *
+ */
+
+#include <coroutine>
+#include <memory>
+#include <vector>
+
+#include "common.hpp"
+#include "co_grpc/executor.hpp"
+
+using namespace co_grpc_test;
+
+namespace {
+
+    /* Items are the integers from 1, so none is nullptr */
+    inline void*
+    item(std::size_t _value) noexcept
+    {
+        return reinterpret_cast<void*>(_value);
+    }
+
+    inline std::size_t
+    value(void* _item) noexcept
+    {
+        return reinterpret_cast<std::size_t>(_item);
+    }
+
+    class seen {
+
+        public:
+
+            explicit seen(std::size_t _count) : counts_(new std::atomic<int>[_count + 1]{}) { }
+
+            void
+            take(void* _item) noexcept
+            {
+                counts_[value(_item)].fetch_add(1, std::memory_order_relaxed);
+                taken_.fetch_add(1, std::memory_order_release);
+            }
+
+            std::size_t
+            taken() const noexcept
+            {
+                return taken_.load(std::memory_order_acquire);
+            }
+
+            void
+            check(std::size_t _count) const
+            {
+                for (std::size_t i = 1; i <= _count; ++i) { CHECK(counts_[i].load() == 1); }
+            }
+
+        private:
+
+            std::unique_ptr<std::atomic<int>[]> counts_;
+
+            std::atomic<std::size_t> taken_{0};
+    };
+
+    /* The owner pushes in runs and pops some back while thieves steal, the ring starts tiny */
+    void
+    work_deque()
+    {
+        constexpr std::size_t kItems   = 400000;
+        constexpr int         kThieves = 3;
+
+        co_grpc::work_deque deque(2);
+        seen                taken(kItems);
+
+        std::atomic<bool>        done{false};
+        std::vector<std::thread> thieves;
+        for (int t = 0; t < kThieves; ++t)
+        {
+            thieves.emplace_back([&] {
+                while (!done.load(std::memory_order_acquire) || !deque.empty())
+                {
+                    if (auto* stolen = deque.steal()) { taken.take(stolen); }
+                }
+            });
+        }
+
+        std::size_t next = 1;
+        while (next <= kItems)
+        {
+            const auto run = std::min<std::size_t>(1 + next % 97, kItems - next + 1);
+            for (std::size_t i = 0; i < run; ++i) { deque.push(item(next++)); }
+
+            for (std::size_t i = 0; i < run / 2; ++i)
+            {
+                if (auto* popped = deque.pop()) { taken.take(popped); }
+            }
+        }
+
+        while (auto* popped = deque.pop()) { taken.take(popped); }
+
+        done.store(true, std::memory_order_release);
+        for (auto& thief : thieves) { thief.join(); }
+
+        CHECK(taken.taken() == kItems);
+        taken.check(kItems);
+    }
+
+    /* Producers outrun a small ring, so some items go through the overflow */
+    void
+    inject_queue()
+    {
+        constexpr std::size_t kPerProducer = 100000;
+        constexpr std::size_t kProducers   = 4;
+        constexpr std::size_t kConsumers   = 4;
+        constexpr std::size_t kItems       = kPerProducer * kProducers;
+
+        co_grpc::inject_queue queue(64);
+        seen                  taken(kItems);
+
+        std::vector<std::thread> threads;
+        for (std::size_t p = 0; p < kProducers; ++p)
+        {
+            threads.emplace_back([&, p] {
+                for (std::size_t i = 1; i <= kPerProducer; ++i)
+                {
+                    queue.push(item(p * kPerProducer + i));
+                }
+            });
+        }
+
+        for (std::size_t c = 0; c < kConsumers; ++c)
+        {
+            threads.emplace_back([&] {
+                while (taken.taken() < kItems)
+                {
+                    if (auto* popped = queue.pop()) { taken.take(popped); }
+                }
+            });
+        }
+
+        for (auto& thread : threads) { thread.join(); }
+
+        CHECK(queue.empty());
+        taken.check(kItems);
+    }
+
+    struct hop {
+
+            co_grpc::pool_executor& executor_;
+
+            bool
+            await_ready() const noexcept
+            {
+                return false;
+            }
+
+            void
+            await_suspend(std::coroutine_handle<> _awaiter)
+            {
+                executor_.execute(_awaiter.address());
+            }
+
+            void
+            await_resume() const noexcept
+            { }
+    };
+
+    detached
+    hopper(co_grpc::pool_executor& _executor, int _hops, std::atomic<int>& _done)
+    {
+        for (int i = 0; i < _hops; ++i) { co_await hop{_executor}; }
+
+        _done.fetch_add(1, std::memory_order_release);
+    }
+
+    /* Coroutines post themselves from inside the pool and from outside of it */
+    void
+    thread_pool()
+    {
+        co_grpc::thread_pool   pool({.threads = 4, .inject_capacity = 256});
+        co_grpc::pool_executor executor(pool);
+
+        for (int round = 0; round < 20; ++round)
+        {
+            std::atomic<int> done{0};
+            for (int i = 0; i < 500; ++i) { hopper(executor, 50, done); }
+
+            wait_for([&] { return done.load(std::memory_order_acquire) == 500; });
+
+            /* Let the workers park before the next round wakes them */
+            std::this_thread::sleep_for(std::chrono::microseconds(round * 50));
+        }
+    }
+
+}   // namespace
+
+int
+main()
+{
+    work_deque();
+    inject_queue();
+    thread_pool();
+
+    std::puts("executor_test: ok");
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * The hand over from the service thread to a consumer blocked in `next()`: bursts of rpcs with
+ * pauses in between so the consumer parks and is woken over and over, with and without
+ * spinning first, and stopping a service while its consumer is parked.
+ *
+ */
+
+#include <random>
+
+#include "common.hpp"
+
+using namespace co_grpc_test;
+
+namespace {
+
+    detached
+    echo(client& _client, std::atomic<int>& _good, std::atomic<int>& _done)
+    {
+        Msg request;
+        request.set_value("x");
+
+        auto reply = co_await _client.call(&Stub::AsyncEcho, request);
+        if (reply.status.ok()) { _good.fetch_add(1, std::memory_order_relaxed); }
+
+        _done.fetch_add(1, std::memory_order_release);
+    }
+
+    void
+    bursts(std::size_t _spin)
+    {
+        server srv([_spin](service& _service) {
+            _service.consumer_spin(_spin);
+            new echo_request(_service);
+        });
+
+        constexpr int kThreads = 4;
+        constexpr int kBursts  = 150;
+        constexpr int kBurst   = 16;
+
+        std::atomic<int>         good{0};
+        std::vector<std::thread> callers;
+        for (int t = 0; t < kThreads; ++t)
+        {
+            callers.emplace_back([&, t] {
+                client cl;
+                cl.connect(srv.address(), grpc::InsecureChannelCredentials());
+                cl.run();
+
+                std::minstd_rand                pause_rng(t + 1);
+                std::uniform_int_distribution<> pause(0, 300);
+
+                std::atomic<int> done{0};
+                for (int b = 0; b < kBursts; ++b)
+                {
+                    for (int i = 0; i < kBurst; ++i) { echo(cl, good, done); }
+
+                    wait_for([&] {
+                        return done.load(std::memory_order_acquire) == (b + 1) * kBurst;
+                    });
+                    std::this_thread::sleep_for(std::chrono::microseconds(pause(pause_rng)));
+                }
+
+                cl.stop();
+            });
+        }
+
+        for (auto& caller : callers) { caller.join(); }
+        CHECK(good.load() == kThreads * kBursts * kBurst);
+    }
+
+    /* `clean` must find and wake a consumer that parked on an empty queue */
+    void
+    stop_while_parked()
+    {
+        for (int i = 0; i < 200; ++i)
+        {
+            service svc;
+            svc.build("127.0.0.1:0", grpc::InsecureServerCredentials());
+            new echo_request(svc);
+            svc.run();
+
+            std::atomic<bool> returned{false};
+            std::thread       consumer([&] {
+                while (auto* item = svc.next()) { item->proceed(); }
+                returned.store(true, std::memory_order_release);
+            });
+
+            std::this_thread::sleep_for(std::chrono::microseconds(i % 5 * 100));
+            svc.stop();
+
+            wait_for([&] { return returned.load(std::memory_order_acquire); });
+            consumer.join();
+        }
+    }
+
+}   // namespace
+
+int
+main()
+{
+    bursts(0);
+    bursts(64);
+    stop_while_parked();
+
+    std::puts("queue_test: ok");
+    return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * Unary rpcs through a service and a client, the load report, inline lanes and the readiness
+ * fd.
+ *
+ */
+
+#include <poll.h>
+
+#include "common.hpp"
+
+using namespace co_grpc_test;
+
+namespace {
+
+    detached
+    echo(client& _client, std::string _value, std::atomic<int>& _good, std::atomic<int>& _done)
+    {
+        Msg request;
+        request.set_value(_value);
+
+        auto reply = co_await _client.call(&Stub::AsyncEcho, request);
+        if (reply.status.ok() && reply.message.value() == _value)
+        {
+            _good.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        _done.fetch_add(1, std::memory_order_release);
+    }
+
+    void
+    unary_round_trip()
+    {
+        server srv;
+
+        client cl;
+        cl.connect(srv.address(), grpc::InsecureChannelCredentials());
+        cl.run();
+
+        std::atomic<int> good{0};
+        std::atomic<int> done{0};
+        for (int i = 0; i < 500; ++i) { echo(cl, std::to_string(i), good, done); }
+
+        wait_for([&] { return done.load(std::memory_order_acquire) == 500; });
+        CHECK(good.load() == 500);
+
+        cl.stop();
+    }
+
+    void
+    load_report()
+    {
+        server srv([](service& _service) {
+            _service.report_load(std::chrono::milliseconds(1));
+            new echo_request(_service);
+        });
+
+        auto channel = grpc::CreateChannel(srv.address(), grpc::InsecureChannelCredentials());
+        Stub stub(channel);
+
+        grpc::CompletionQueue cq;
+        for (int i = 0; i < 3; ++i)
+        {
+            grpc::ClientContext ctx;
+            Msg                 request;
+            Msg                 reply;
+            grpc::Status        status;
+            request.set_value("load");
+
+            auto reader = stub.AsyncEcho(&ctx, request, &cq);
+            reader->Finish(&reply, &status, &ctx);
+
+            void* tag;
+            bool  ok;
+            CHECK(cq.Next(&tag, &ok) && ok && tag == &ctx);
+            CHECK(status.ok());
+
+            const auto& trailers = ctx.GetServerTrailingMetadata();
+            const auto  it       = trailers.find(
+                grpc::string_ref(co_grpc::kLoadReportKey.data(), co_grpc::kLoadReportKey.size()));
+            CHECK(it != trailers.end());
+
+            /* In flight, queued and delay */
+            const std::string report(it->second.data(), it->second.size());
+            CHECK(std::count(report.begin(), report.end(), ',') == 2);
+        }
+
+        cq.Shutdown();
+        void* tag;
+        bool  ok;
+        while (cq.Next(&tag, &ok)) { }
+    }
+
+    /* No consumer at all, so only the lane can serve these */
+    void
+    inline_lane()
+    {
+        service::inline_lane lane(std::chrono::seconds(1));
+
+        service svc;
+        int     port = 0;
+        svc.build_with_access(
+            "127.0.0.1:0",
+            grpc::InsecureServerCredentials(),
+            [&](grpc::ServerBuilder& _builder) {
+                _builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &port);
+            });
+        new echo_request(svc, {}, &lane);
+        svc.run();
+
+        client cl;
+        cl.connect("127.0.0.1:" + std::to_string(port), grpc::InsecureChannelCredentials());
+        cl.run();
+
+        std::atomic<int> good{0};
+        std::atomic<int> done{0};
+        for (int i = 0; i < 100; ++i) { echo(cl, std::to_string(i), good, done); }
+
+        wait_for([&] { return done.load(std::memory_order_acquire) == 100; });
+        CHECK(good.load() == 100);
+        CHECK(lane.open());
+
+        cl.stop();
+        svc.stop();
+        while (auto* item = svc.try_next()) { item->proceed(); }
+    }
+
+    /* Driven from poll(2) with `try_next` instead of a blocked consumer */
+    void
+    readiness()
+    {
+        service svc;
+        int     port = 0;
+        svc.build_with_access(
+            "127.0.0.1:0",
+            grpc::InsecureServerCredentials(),
+            [&](grpc::ServerBuilder& _builder) {
+                _builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &port);
+            });
+
+        const int fd = svc.enable_readiness();
+        CHECK(fd >= 0);
+
+        new echo_request(svc);
+        svc.run();
+
+        std::atomic<bool> stop{false};
+        std::thread       consumer([&] {
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                pollfd ready{fd, POLLIN, 0};
+                if (::poll(&ready, 1, 10) <= 0) { continue; }
+
+                while (auto* item = svc.try_next()) { item->proceed(); }
+            }
+        });
+
+        client cl;
+        cl.connect("127.0.0.1:" + std::to_string(port), grpc::InsecureChannelCredentials());
+        cl.run();
+
+        std::atomic<int> good{0};
+        std::atomic<int> done{0};
+        for (int round = 0; round < 20; ++round)
+        {
+            for (int i = 0; i < 10; ++i) { echo(cl, std::to_string(i), good, done); }
+
+            wait_for([&] { return done.load(std::memory_order_acquire) == (round + 1) * 10; });
+        }
+
+        CHECK(good.load() == 200);
+
+        cl.stop();
+        stop.store(true, std::memory_order_relaxed);
+        consumer.join();
+
+        svc.stop();
+        while (auto* item = svc.try_next()) { item->proceed(); }
+    }
+
+}   // namespace
+
+int
+main()
+{
+    unary_round_trip();
+    load_report();
+    inline_lane();
+    readiness();
+
+    std::puts("service_test: ok");
+    return 0;
+}
@@ -0,0 +1,225 @@
+/*
+ * Server streams from a generator, client streams read in batches, and bulk rpcs from a
+ * batcher.
+ *
+ */
+
+#include "common.hpp"
+
+using namespace co_grpc_test;
+
+namespace {
+
+    using stream_request = service::stream_request<Msg, Msg, count_handler>;
+
+    detached
+    read_stream(client& _client, int _count, std::atomic<int>& _good, std::atomic<int>& _done)
+    {
+        Msg request;
+        request.set_value(std::to_string(_count));
+
+        auto stream = _client.stream(&Stub::PrepareAsyncStream, request);
+
+        int  seen    = 0;
+        bool ordered = true;
+        while (auto* message = co_await stream.next())
+        {
+            ordered = ordered && message->value() == std::to_string(seen);
+            ++seen;
+        }
+
+        if (ordered && seen == _count && stream.status().ok())
+        {
+            _good.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        _done.fetch_add(1, std::memory_order_release);
+    }
+
+    void
+    server_streams()
+    {
+        server srv([](service& _service) {
+            new stream_request(_service, &AsyncService::RequestStream, &count_to, 4);
+        });
+
+        client cl;
+        cl.connect(srv.address(), grpc::InsecureChannelCredentials());
+        cl.run();
+
+        std::atomic<int> good{0};
+        std::atomic<int> done{0};
+        for (int i = 0; i < 50; ++i) { read_stream(cl, i * 40, good, done); }
+
+        wait_for([&] { return done.load(std::memory_order_acquire) == 50; });
+        CHECK(good.load() == 50);
+
+        cl.stop();
+    }
+
+    /* A finished generator, or an empty one, keeps returning nullptr */
+    void
+    generator_end()
+    {
+        Msg request;
+        request.set_value("2");
+
+        auto messages = count_to(request);
+        CHECK(messages.next()->value() == "0");
+        CHECK(messages.next()->value() == "1");
+        CHECK(!messages.next());
+        CHECK(!messages.next());
+        CHECK(messages.status().ok());
+
+        co_grpc::generator<Msg> empty;
+        CHECK(!empty.next());
+    }
+
+    co_grpc::task<grpc::Status>
+    count_uploads(co_grpc::batch_reader<Msg>& _reader, Msg& _reply)
+    {
+        int count = 0;
+        while (true)
+        {
+            auto batch = co_await _reader.read_batch(16);
+            if (batch.empty()) { break; }
+
+            for (auto& message : batch)
+            {
+                if (message.value() != std::to_string(count))
+                {
+                    co_return grpc::Status(grpc::StatusCode::DATA_LOSS, "out of order");
+                }
+
+                ++count;
+            }
+        }
+
+        _reply.set_value(std::to_string(count));
+        co_return grpc::Status::OK;
+    }
+
+    using upload_handler = co_grpc::task<grpc::Status> (*)(co_grpc::batch_reader<Msg>&, Msg&);
+    using upload_request = service::client_stream_request<Msg, Msg, upload_handler>;
+
+    void
+    client_streams()
+    {
+        server srv([](service& _service) {
+            new upload_request(_service, &AsyncService::RequestUpload, &count_uploads, 32);
+        });
+
+        auto channel = grpc::CreateChannel(srv.address(), grpc::InsecureChannelCredentials());
+
+        std::vector<std::thread> writers;
+        std::atomic<int>         good{0};
+        for (int t = 0; t < 8; ++t)
+        {
+            writers.emplace_back([&, t] {
+                Stub stub(channel);
+                for (int round = 0; round < 5; ++round)
+                {
+                    const int count = t * 300 + round * 7;
+
+                    grpc::ClientContext ctx;
+                    Msg                 reply;
+                    auto                writer = stub.Upload(&ctx, &reply);
+
+                    Msg message;
+                    for (int i = 0; i < count; ++i)
+                    {
+                        message.set_value(std::to_string(i));
+                        if (!writer->Write(message)) { break; }
+                    }
+
+                    writer->WritesDone();
+                    if (writer->Finish().ok() && reply.value() == std::to_string(count))
+                    {
+                        good.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            });
+        }
+
+        for (auto& writer : writers) { writer.join(); }
+        CHECK(good.load() == 40);
+    }
+
+    grpc::Status
+    echo_value(const Value& _request, Value& _reply)
+    {
+        _reply.set_string_value(_request.string_value());
+        return grpc::Status::OK;
+    }
+
+    using value_handler = grpc::Status (*)(const Value&, Value&);
+    using batch_request = service::batch_request<Value, Value, List, List, value_handler>;
+    using value_batcher = co_grpc::batcher<client, Value, Value, List, List>;
+
+    detached
+    batched(value_batcher& _batcher, int _index, std::atomic<int>& _good, std::atomic<int>& _done)
+    {
+        Value request;
+        request.set_string_value(std::to_string(_index));
+
+        auto reply = co_await _batcher.call(request);
+        if (reply.status.ok() && reply.message.string_value() == std::to_string(_index))
+        {
+            _good.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        _done.fetch_add(1, std::memory_order_release);
+    }
+
+    void
+    batches()
+    {
+        server srv([](service& _service) {
+            new batch_request(
+                _service,
+                &AsyncService::RequestBatch,
+                &List::values,
+                &List::values_size,
+                &List::add_values,
+                &echo_value);
+        });
+
+        client cl;
+        cl.connect(srv.address(), grpc::InsecureChannelCredentials());
+        cl.run();
+
+        value_batcher batcher(
+            cl,
+            &Stub::AsyncBatch,
+            &List::add_values,
+            &List::values,
+            &List::values_size,
+            {.max_batch = 16, .window = std::chrono::microseconds(500)});
+
+        std::atomic<int> good{0};
+        std::atomic<int> done{0};
+        for (int round = 0; round < 10; ++round)
+        {
+            for (int i = 0; i < 100; ++i) { batched(batcher, round * 100 + i, good, done); }
+
+            wait_for([&] { return done.load(std::memory_order_acquire) == (round + 1) * 100; });
+        }
+
+        CHECK(good.load() == 1000);
+
+        cl.stop();
+    }
+
+}   // namespace
+
+int
+main()
+{
+    generator_end();
+    server_streams();
+    client_streams();
+    batches();
+
+    std::puts("stream_test: ok");
+    return 0;
+}
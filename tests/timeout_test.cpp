@@ -0,0 +1,282 @@
+/*
+ * Request timeouts in the timer wheel: ones that expire in the first level and ones that are
+ * cascaded down from the higher levels, requests that finish in time, and idle timeouts of
+ * client streams.
+ *
+ */
+
+#include "common.hpp"
+
+using namespace co_grpc_test;
+
+namespace {
+
+    /* Serves `Echo`, finishing `hold` after it arrives unless its timeout cancels it first */
+    class timed_request : public service::request {
+
+        public:
+
+            timed_request(
+                service&                  _service,
+                std::chrono::microseconds _timeout,
+                std::chrono::milliseconds _hold)
+                : service::request(_service), responder_(&this->context()), timeout_(_timeout),
+                  hold_(_hold)
+            {
+                timeout(_timeout);
+
+                server().service().RequestEcho(
+                    &this->context(),
+                    &request_,
+                    &responder_,
+                    &server().completion_queue(),
+                    &server().completion_queue(),
+                    this);
+            }
+
+        private:
+
+            void
+            process() override
+            {
+                reply_.set_value(request_.value());
+                if (!hold_.count())
+                {
+                    finish();
+                    return;
+                }
+
+                server().after(hold_, [this] { finish(); });
+            }
+
+            void
+            finish()
+            {
+                complete();
+                responder_.Finish(reply_, grpc::Status::OK, this);
+            }
+
+            void
+            clone() override
+            {
+                new timed_request(server(), timeout_, hold_);
+            }
+
+            grpc::ServerAsyncResponseWriter<Msg> responder_;
+
+            std::chrono::microseconds timeout_;
+            std::chrono::milliseconds hold_;
+
+            Msg request_;
+            Msg reply_;
+    };
+
+    struct outcome {
+
+            std::atomic<int> done{0};
+            std::atomic<int> cancelled{0};
+            std::atomic<int> late{0};
+    };
+
+    detached
+    timed_call(client& _client, std::chrono::microseconds _timeout, outcome& _outcome)
+    {
+        Msg request;
+        request.set_value("x");
+
+        const auto start = std::chrono::steady_clock::now();
+        auto       reply = co_await _client.call(&Stub::AsyncEcho, request);
+        const auto took  = std::chrono::steady_clock::now() - start;
+
+        if (reply.status.error_code() == grpc::StatusCode::CANCELLED)
+        {
+            _outcome.cancelled.fetch_add(1, std::memory_order_relaxed);
+
+            /* Never early, and not cascaded a level late */
+            CHECK(took >= _timeout);
+            if (took > _timeout + std::chrono::milliseconds(500))
+            {
+                _outcome.late.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        _outcome.done.fetch_add(1, std::memory_order_release);
+    }
+
+    /*
+     * With a 20us tick the first level covers 5ms and the second 1.3s, so these expire from
+     * each of the first three levels.
+     *
+     */
+    void
+    cascading()
+    {
+        const std::chrono::microseconds timeouts[] = {
+            std::chrono::microseconds(2000),
+            std::chrono::microseconds(40000),
+            std::chrono::microseconds(1500000)};
+
+        for (const auto timeout : timeouts)
+        {
+            server srv([timeout](service& _service) {
+                _service.enable_timeouts(std::chrono::microseconds(20));
+                new timed_request(
+                    _service,
+                    timeout,
+                    std::chrono::duration_cast<std::chrono::milliseconds>(timeout) +
+                        std::chrono::seconds(2));
+            });
+
+            client cl;
+            cl.connect(srv.address(), grpc::InsecureChannelCredentials());
+            cl.run();
+
+            outcome result;
+            for (int i = 0; i < 20; ++i) { timed_call(cl, timeout, result); }
+
+            wait_for([&] { return result.done.load(std::memory_order_acquire) == 20; });
+            CHECK(result.cancelled.load() == 20);
+            CHECK(result.late.load() == 0);
+
+            /* Let the held replies go out before the service stops */
+            std::this_thread::sleep_for(
+                std::chrono::duration_cast<std::chrono::milliseconds>(timeout) +
+                std::chrono::milliseconds(2200));
+
+            cl.stop();
+        }
+    }
+
+    /* Finished requests leave the wheel and are never cancelled */
+    void
+    in_time()
+    {
+        constexpr std::chrono::microseconds kTimeout(200000);
+
+        server srv([](service& _service) {
+            _service.enable_timeouts(std::chrono::microseconds(100));
+            new timed_request(_service, kTimeout, std::chrono::milliseconds(0));
+        });
+
+        client cl;
+        cl.connect(srv.address(), grpc::InsecureChannelCredentials());
+        cl.run();
+
+        /* In waves, so none waits on the consumer for as long as its timeout */
+        outcome result;
+        for (int wave = 0; wave < 10; ++wave)
+        {
+            for (int i = 0; i < 50; ++i) { timed_call(cl, kTimeout, result); }
+
+            wait_for([&] {
+                return result.done.load(std::memory_order_acquire) == (wave + 1) * 50;
+            });
+        }
+
+        CHECK(result.cancelled.load() == 0);
+
+        cl.stop();
+    }
+
+    co_grpc::task<grpc::Status>
+    count_uploads(co_grpc::batch_reader<Msg>& _reader, Msg& _reply)
+    {
+        std::size_t count = 0;
+        while (true)
+        {
+            auto batch = co_await _reader.read_batch(1);
+            if (batch.empty()) { break; }
+
+            count += batch.size();
+        }
+
+        _reply.set_value(std::to_string(count));
+        co_return grpc::Status::OK;
+    }
+
+    using upload_handler = co_grpc::task<grpc::Status> (*)(co_grpc::batch_reader<Msg>&, Msg&);
+    using upload_request = service::client_stream_request<Msg, Msg, upload_handler>;
+
+    /* Writes `_writes` messages, pausing `_pause` before each and `_stall` before the last */
+    grpc::Status
+    upload(
+        Stub&                     _stub,
+        int                       _writes,
+        std::chrono::milliseconds _pause,
+        std::chrono::milliseconds _stall,
+        Msg&                      _reply)
+    {
+        grpc::ClientContext ctx;
+        auto                writer = _stub.Upload(&ctx, &_reply);
+
+        Msg message;
+        message.set_value("x");
+        for (int i = 0; i < _writes; ++i)
+        {
+            std::this_thread::sleep_for(i + 1 == _writes ? _stall : _pause);
+            if (!writer->Write(message)) { break; }
+        }
+
+        writer->WritesDone();
+        return writer->Finish();
+    }
+
+    /*
+     * Reads of a client stream restart its idle timeout, so a stream that writes more often
+     * than that lives for longer. Each rpc is served by a clone of the request the timeout was
+     * set on.
+     *
+     */
+    void
+    idle()
+    {
+        server srv([](service& _service) {
+            _service.enable_timeouts(std::chrono::milliseconds(10));
+
+            auto* first =
+                new upload_request(_service, &AsyncService::RequestUpload, &count_uploads, 1);
+            first->idle_timeout(std::chrono::milliseconds(150));
+        });
+
+        Stub stub(grpc::CreateChannel(srv.address(), grpc::InsecureChannelCredentials()));
+
+        for (int i = 0; i < 3; ++i)
+        {
+            Msg        reply;
+            const auto status = upload(
+                stub,
+                8,
+                std::chrono::milliseconds(50),
+                std::chrono::milliseconds(50),
+                reply);
+
+            CHECK(status.ok());
+            CHECK(reply.value() == "8");
+        }
+
+        for (int i = 0; i < 2; ++i)
+        {
+            Msg        reply;
+            const auto status = upload(
+                stub,
+                3,
+                std::chrono::milliseconds(50),
+                std::chrono::milliseconds(400),
+                reply);
+
+            CHECK(status.error_code() == grpc::StatusCode::CANCELLED);
+        }
+    }
+
+}   // namespace
+
+int
+main()
+{
+    cascading();
+    in_time();
+    idle();
+
+    std::puts("timeout_test: ok");
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Sleeps and delayed work on the service's completion queue, cancelling them on stop, and
+ * starting and stopping a service whose periodic alarms are firing.
+ *
+ */
+
+#include "common.hpp"
+
+using namespace co_grpc_test;
+
+namespace {
+
+    detached
+    sleeper(service& _service, std::chrono::milliseconds _duration, std::atomic<int>& _woken)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        co_await _service.sleep_for(_duration);
+
+        CHECK(std::chrono::steady_clock::now() - start >= _duration);
+        _woken.fetch_add(1, std::memory_order_release);
+    }
+
+    void
+    sleep_and_after()
+    {
+        server srv([](service&) { });
+
+        std::atomic<int> woken{0};
+        std::atomic<int> ran{0};
+
+        for (int i = 0; i < 50; ++i)
+        {
+            sleeper(srv.get(), std::chrono::milliseconds(i % 10), woken);
+            srv.get().after(std::chrono::milliseconds(i % 5), [&ran] {
+                ran.fetch_add(1, std::memory_order_release);
+            });
+        }
+
+        wait_for([&] {
+            return woken.load(std::memory_order_acquire) == 50 &&
+                   ran.load(std::memory_order_acquire) == 50;
+        });
+    }
+
+    detached
+    cancelled_sleeper(service& _service, std::atomic<int>& _woken)
+    {
+        co_await _service.sleep_for(std::chrono::hours(1));
+        _woken.fetch_add(1, std::memory_order_release);
+    }
+
+    /* A sleep is resumed early by stop, delayed work is dropped */
+    void
+    cancelled_on_stop()
+    {
+        std::atomic<int> woken{0};
+        std::atomic<int> ran{0};
+
+        {
+            server srv([](service&) { });
+
+            for (int i = 0; i < 20; ++i)
+            {
+                cancelled_sleeper(srv.get(), woken);
+                srv.get().after(std::chrono::hours(1), [&ran] {
+                    ran.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+        }
+
+        wait_for([&] { return woken.load(std::memory_order_acquire) == 20; });
+        CHECK(ran.load() == 0);
+    }
+
+    /* Stop while the load report and the wheel tick are re-arming */
+    void
+    start_stop()
+    {
+        for (int i = 0; i < 200; ++i)
+        {
+            service svc;
+            svc.build("127.0.0.1:0", grpc::InsecureServerCredentials());
+            svc.report_load(std::chrono::microseconds(1));
+            svc.enable_timeouts(std::chrono::microseconds(1));
+            svc.run();
+
+            std::this_thread::sleep_for(std::chrono::microseconds(i % 7 * 50));
+            svc.stop();
+
+            while (auto* item = svc.try_next()) { item->proceed(); }
+        }
+    }
+
+}   // namespace
+
+int
+main()
+{
+    sleep_and_after();
+    cancelled_on_stop();
+    start_stop();
+
+    std::puts("timer_test: ok");
+    return 0;
+}